@@ -18,18 +18,89 @@
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/CFG.h"
 #include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/DebugInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpander.h"
 
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/PromoteMemToReg.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/SourceMgr.h"
 
 #include "llvm/ADT/StringMap.h"
 
 #include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
 #include <math.h>
 #include <unistd.h>
 #include <string.h>
 
 #define MAINFILE "Enclave.c"
 
+//number of log2 scaled bins per histogram, must match detect.c
+#define TE_HIST_BINS 16
+
+//number of memory footprint classes for learned page fault penalties
+#define TE_FOOTPRINT_CLASSES 4
+
+//every TE_HOLDOUT_RUNS-th ecall run is held out for tfactor calibration
+#define TE_HOLDOUT_RUNS 5
+
+//cusum scores are kept in 1/2^TE_CUSUM_FRACTION_BITS of a standard deviation
+#define TE_CUSUM_FRACTION_BITS 4
+//fixed point bits of the per context cusum multiplier (cusumMultiplier)
+#define TE_CUSUM_SCALE_BITS 16
+
+//cusum reference value, in standard deviations above the average
+#define TE_CUSUM_SLACK 0.5
+
+//the most predecessors duplicateTails lets a successor reach, the arity of detect1..4
+#define TE_INLINE_CONTEXTS 4
+
+//components of the per context mixture model (mode 20)
+#define TE_MIXTURE_COMPONENTS 2
+#define TE_MIXTURE_ITERATIONS 50
+#define TE_MIXTURE_MIN_WEIGHT 0.05
+
+//head room of static bounds for sites never seen in training
+#define TE_STATIC_MARGIN 4
+
+//secure_timer in timer.c advances current_time by 1..8 per round
+#define TE_TIMER_STEP_AVERAGE 4.5
+#define TE_TIMER_STEP_VARIANCE 5.25
+
+//compact tables (mode 23): context index of type1 blocks that are no context, u8 bounds step limit
+#define TE_COMPACT_NO_CONTEXT 0xffff
+#define TE_COMPACT_TOLERANCE 16
+
+//input classes with a model of their own (mode 24)
+#define TE_MAX_INPUT_CLASSES 16
+
+//online refinement (mode 25): EWMA weight 2^-TE_EWMA_SHIFT, c moves at most TE_EWMA_CLAMP of its trained value
+#define TE_EWMA_SHIFT 4
+#define TE_EWMA_CLAMP 0.25
+
+//site tables (instrument_function_detect): sorted up to TE_TABLE_LINEAR contexts, hashed above, must match detect.c
+#define TE_TABLE_LINEAR 8
+#define TE_TABLE_EMPTY 0x8000000000000000ULL
+
+//loop aggregated checks (mode 27): per iteration bounds in 1/2^TE_LOOP_FRACTION_BITS ticks
+#define TE_LOOP_FRACTION_BITS 4
+
+//branch weight of passing a check against failing it (outlineReports)
+#define TE_REPORT_WEIGHT 2000
+
+//lower bound of the two sided checks added after mode 16, in standard deviations below the average (lowerBound)
+#define TE_LOWER_SIGMAS 3
+
 
 using namespace llvm;
 
@@ -78,11 +149,209 @@ std::vector<struct bb_num_s> bb_num_s_list;
 //ecall function
 char p_entry_function[40], p_entry_file[220], p_reference_function[40];
 
+//detection runtime as bitcode, linked in when set
+char p_runtime_file[220] = "";
+
+//functions checked per call (mode 28), one name per line, every function when not set
+char p_coarse_file[220] = "";
+
+//site keys: 0 block names, 1 debug locations and CFG shape (labelBlocks)
+int site_keys = 0;
+
+//check table driven sites on every sample_period-th execution, at random intervals of that average with sample_random 1
+long sample_period = 1;
+int sample_random = 0;
+
+//share of the trained ticks the checks may cost, 0 for no limit, and the cost of one check in ticks
+double overhead_budget = 0;
+double check_cost = 1;
+
+//largest code growth, in instructions, of giving each incoming edge of a block its own copy, 0 for no copies
+long duplicate_limit = 0;
+
 //page fault metrics
 double page_fault_average = 1000000;
 double page_fault_stdev = 0;
 double tfactor = 0;
 
+//detection quantile for sketch based thresholds
+double quantile = 0.999;
+
+//target false positive rate of per site tfactor calibration
+double target_fpr = 0.001;
+
+//alarm limit of the cusum statistic, in standard deviations
+double cusum_limit = 5.0;
+
+//contexts scoring below it get no check
+double prune_threshold = 0.1;
+
+//time every check with get_time (modes 15, 26)
+int measure_checks = 0;
+
+
+/**
+	tdigest
+	--streaming quantile sketch, merging t-digest with the k1 scale function
+	--merging two sketches only re-compresses their centroids, so per run sketches
+	  from parallel or incremental training can be combined cheaply
+*/
+struct tdigest
+{
+	double compression = 100;
+	double total = 0;
+	double min = 0;
+	double max = 0;
+	std::vector<double> mean;
+	std::vector<double> weight;
+	std::vector<double> buffer_mean;
+	std::vector<double> buffer_weight;
+
+	void add(double x, double w)
+	{
+		if(total == 0 || x < min) min = x;
+		if(total == 0 || x > max) max = x;
+		buffer_mean.push_back(x);
+		buffer_weight.push_back(w);
+		total += w;
+		if(buffer_mean.size() >= 8 * compression) compress();
+	}
+
+	void merge(struct tdigest &other)
+	{
+		other.compress();
+		if(other.total == 0) return;
+		double other_min = other.min, other_max = other.max;
+		for(size_t i = 0; i < other.mean.size(); i++)
+			add(other.mean[i], other.weight[i]);
+		if(other_min < min) min = other_min;
+		if(other_max > max) max = other_max;
+	}
+
+	double scale(double q)
+	{
+		return compression / (2 * M_PI) * asin(2 * q - 1);
+	}
+
+	void compress()
+	{
+		if(buffer_mean.empty()) return;
+		std::vector<std::pair<double, double> > all;
+		for(size_t i = 0; i < mean.size(); i++)
+			all.push_back(std::make_pair(mean[i], weight[i]));
+		for(size_t i = 0; i < buffer_mean.size(); i++)
+			all.push_back(std::make_pair(buffer_mean[i], buffer_weight[i]));
+		std::sort(all.begin(), all.end());
+		mean.clear();
+		weight.clear();
+		buffer_mean.clear();
+		buffer_weight.clear();
+
+		//greedily fold neighbours while the centroid spans at most one unit of k
+		double so_far = 0;
+		double cur_mean = all[0].first, cur_weight = all[0].second;
+		double k_low = scale(0);
+		for(size_t i = 1; i < all.size(); i++)
+		{
+			double proposed = cur_weight + all[i].second;
+			if(scale((so_far + proposed) / total) - k_low <= 1)
+			{
+				cur_mean += (all[i].first - cur_mean) * all[i].second / proposed;
+				cur_weight = proposed;
+			}
+			else
+			{
+				mean.push_back(cur_mean);
+				weight.push_back(cur_weight);
+				so_far += cur_weight;
+				k_low = scale(so_far / total);
+				cur_mean = all[i].first;
+				cur_weight = all[i].second;
+			}
+		}
+		mean.push_back(cur_mean);
+		weight.push_back(cur_weight);
+	}
+
+	double quantile(double q)
+	{
+		compress();
+		if(mean.empty()) return 0;
+		double index = q * total;
+		//centroid means sit in the middle of their weight, interpolate between them
+		//and towards min / max at the tails
+		if(index < weight[0] / 2)
+			return min + (mean[0] - min) * index / (weight[0] / 2);
+		double cum = 0;
+		for(size_t i = 0; i + 1 < mean.size(); i++)
+		{
+			double left = cum + weight[i] / 2;
+			double right = cum + weight[i] + weight[i + 1] / 2;
+			if(index <= right)
+				return mean[i] + (mean[i + 1] - mean[i]) * (index - left) / (right - left);
+			cum += weight[i];
+		}
+		double left = total - weight.back() / 2;
+		if(index >= total) return max;
+		return mean.back() + (max - mean.back()) * (index - left) / (total - left);
+	}
+
+	//average and stdev of the centroids, the spread inside a centroid left out
+	void moments(double &average, double &stdev)
+	{
+		compress();
+		average = 0;
+		stdev = 0;
+		if(total == 0) return;
+		for(size_t i = 0; i < mean.size(); i++)
+			average += mean[i] * weight[i];
+		average /= total;
+		for(size_t i = 0; i < mean.size(); i++)
+			stdev += (mean[i] - average) * (mean[i] - average) * weight[i];
+		stdev = sqrt(stdev / total);
+	}
+};
+
+
+//per (type2 site, type1 context) training statistics
+struct context_model
+{
+	int bb_num = -1;
+	double average = 0;
+	double stdev = 0;
+	std::vector<unsigned long> samples;
+	struct tdigest digest;
+};
+
+//name and source location behind a site id
+struct site_symbol
+{
+	int id;
+	std::string function_name;
+	std::string bb_name;
+	std::string location;
+	std::string module;
+};
+
+//per type2 site, contexts in the order they first show up in the trace
+struct site_model
+{
+	std::string function_name;
+	std::string bb_name;
+	std::vector<struct context_model> contexts;
+};
+
+//per innermost loop, ticks and header executions of every run in the trace (mode 27)
+struct loop_model
+{
+	std::string function_name;
+	std::string header_name;
+	std::vector<unsigned long> ticks;
+	std::vector<unsigned long> trips;
+	double average = 0;
+	double stdev = 0;
+};
+
 
 
 namespace {
@@ -101,16 +370,84 @@ namespace {
 
 	bool runOnModule(Module &M) override;
 
+	//mode 27 asks for loops and trip counts per function
+	void getAnalysisUsage(AnalysisUsage &AU) const override {
+		AU.addRequired<LoopInfo>();
+		AU.addRequired<ScalarEvolution>();
+	}
+
 	void markBBNumType1Type2Info(char *function_name, char *bb_name, int bb_count, int type1, int type2);
 	void printMark(Module &M);
 
+	void loadTraceList(char *currentd, const char *data_name = "/tdata.txt", const char *trace_name = "/ttdata.txt",
+				const char *cache_name = "/ttracedata.txt");
+	void buildSiteModels(llvm::StringMap<struct site_model> &site_map, llvm::StringMap<int> &type1_map);
+	void buildSiteDigests(char *currentd, llvm::StringMap<struct site_model> &site_map);
+	void emitDetectCall(IRBuilder<> &IRB, BasicBlock *BB, struct site_model &sm, std::vector<double> &b_vector, std::vector<double> &c_vector);
+	size_t siteHash(long ctx, int hash_bits);
+	Value *beginCheckTiming(IRBuilder<> &IRB);
+	void endCheckTiming(IRBuilder<> &IRB, Value *begin);
+	void linkRuntime(Module &M, char *currentd);
+	void loadSiteSymbols(char *currentd);
+	int siteKeyId(const std::string &function_name, const std::string &bb_name, const std::string &module);
+	Constant *siteId(BasicBlock *BB);
+	void writeSiteSymbols(char *currentd);
+	void localizeContext(Module &M);
+	void eliminateTimeRedundancy(Module &M);
+	int timeBlind(Function *F, GlobalVariable *previous_gv, std::map<Function *, int> &blind_map);
+	void outlineReports(Module &M);
+	void collectInnerLoops(Loop *L, std::vector<Loop *> &loop_vector);
+	void buildLoopModels(Module &M, char *currentd, llvm::StringMap<struct loop_model> &loop_map);
+	void buildCallModels(Module &M, char *currentd, llvm::StringMap<struct site_model> &call_map);
+	void addCallSample(llvm::StringMap<struct site_model> &call_map, const std::string &function_name, int context, unsigned long ticks);
+	void labelBlocks(Module &M);
+	std::string blockName(BasicBlock *BB);
+	void sampleChecks(Module &M, char *currentd);
+	void budgetSiteModels(char *currentd, llvm::StringMap<struct site_model> &site_map, llvm::StringMap<int> &reset_map,
+				llvm::StringMap<double> &execution_map, double total_ticks, const char *budget_name = "/tbudgetdata.txt");
+	void duplicateTails(Module &M);
+	void contextCounts(Module &M, int &largest, int &over);
+	void readRecords(const char *path, int fields, std::vector<std::vector<std::string> > &records);
+
+	//site ids of the blocks of this module (siteId), sites first numbered by this module, string globals made by createStringArg
+	std::map<BasicBlock *, int> site_ids;
+	std::vector<struct site_symbol> site_symbols;
+	//ids of every site of the enclave, by module, function and bb name, and the next free one (loadSiteSymbols)
+	llvm::StringMap<int> site_table;
+	int site_table_next;
+	llvm::StringMap<Constant *> string_cache;
+	//block names by debug location (labelBlocks), per module
+	std::map<BasicBlock *, std::string> block_labels;
+	//copies made by duplicateTails, type2 sites with their one predecessor as the context, per module
+	std::set<BasicBlock *> tail_copies;
+	void instrumentEcallExit(Function *F, Value *callee, Value *arg);
+	struct context_model *findContext(llvm::StringMap<struct site_model> &site_map, StringRef key, int bb_num);
+	int isType2Block(BasicBlock *BB);
+	int footprintClass(BasicBlock *BB);
+	void loadSiteFactors(char *currentd, llvm::StringMap<double> &factor_map);
+	void splitHeldout(std::vector<struct trace_info> &train_list, std::vector<struct trace_info> &heldout_list);
+	long cusumMultiplier(double stdev);
+	double lowerBound(double average, double stdev);
+	void fitMixture(std::vector<unsigned long> &samples, std::vector<double> &average_vector, std::vector<double> &stdev_vector, std::vector<double> &weight_vector);
+	int instructionCost(Instruction *I);
+	long intervalCost(BasicBlock *BB);
+	void estimateStaticSites(Module &M, char *currentd, llvm::StringMap<struct site_model> &site_map, llvm::StringMap<double> &static_map);
+	void instrumentStaticSites(Module &M, llvm::StringMap<double> &static_map);
+	int loadClockFit(char *currentd, double &slope, double &clock_error);
+	int compactShift(double c_max, int bits);
+	void pruneSiteModels(char *currentd, llvm::StringMap<struct site_model> &site_map, llvm::StringMap<int> &reset_map,
+				const char *prune_name = "/tprunedata.txt", const char *budget_name = "/tbudgetdata.txt");
+	void instrumentTimeReset(Module &M, llvm::StringMap<int> &reset_map);
+
 
 	/**
 		createStringArg Function
-		--a helper function for creating string argument
+		--a helper function for creating string argument, one global per distinct string
 	*/
 	Constant *createStringArg(char *string, Function *F)
 	{
+		Constant *&cached = string_cache[string];
+		if(cached != NULL) return cached;
 		Module *M = F->getParent();
 		LLVMContext &llvm_context = M->getContext();
 		Constant *v_string = ConstantDataArray::getString(llvm_context, string, true);
@@ -121,13 +458,33 @@ namespace {
 		ConstantInt *zero = ConstantInt::get(llvm_context, APInt(32, StringRef("0"), 10));
 		indices.push_back(zero);
 		indices.push_back(zero);
+		cached = ConstantExpr::getGetElementPtr(gvar_array, indices);
+		return cached;
+	}
+
+	/**
+		createTableArg Function
+		--a helper function for creating a constant table argument, like createStringArg
+	*/
+	Constant *createTableArg(Constant *table, Function *F, const char *name)
+	{
+		Module *M = F->getParent();
+		LLVMContext &llvm_context = M->getContext();
+		GlobalVariable *gvar_array = new GlobalVariable(*M, table->getType(), true, GlobalValue::PrivateLinkage, table, name);
+		std::vector<Constant *> indices;
+		ConstantInt *zero = ConstantInt::get(llvm_context, APInt(32, StringRef("0"), 10));
+		indices.push_back(zero);
+		indices.push_back(zero);
 		return ConstantExpr::getGetElementPtr(gvar_array, indices);
 	}
   };
 } // end anonymous namespace
 
 char TimedExecution::ID = 0;
-INITIALIZE_PASS(TimedExecution, "timedexecution", "Timed Execution Pass", false, false)
+INITIALIZE_PASS_BEGIN(TimedExecution, "timedexecution", "Timed Execution Pass", false, false)
+INITIALIZE_PASS_DEPENDENCY(LoopInfo)
+INITIALIZE_PASS_DEPENDENCY(ScalarEvolution)
+INITIALIZE_PASS_END(TimedExecution, "timedexecution", "Timed Execution Pass", false, false)
 
 // createTimedExecutionPass - This is the public interface to this file.
 ModulePass *llvm::createTimedExecutionPass() {
@@ -138,6 +495,11 @@ ModulePass *llvm::createTimedExecutionPass() {
 //
 bool TimedExecution::runOnModule(Module &M) {
 
+	site_ids.clear();
+	tail_copies.clear();
+	site_symbols.clear();
+	string_cache.clear();
+
 	//check the nearest config file recursively up the directory ladder
 	char currentd[100], currentf[100], tcon[20];
 	char *pch;
@@ -211,6 +573,71 @@ bool TimedExecution::runOnModule(Module &M) {
 				//set tfactor
 				tfactor = atof(line);
 			}
+			else if(count == 8)
+			{
+				//set detection quantile
+				quantile = atof(line);
+			}
+			else if(count == 9)
+			{
+				//set target false positive rate for calibration
+				target_fpr = atof(line);
+			}
+			else if(count == 10)
+			{
+				//set cusum alarm limit
+				cusum_limit = atof(line);
+			}
+			else if(count == 11)
+			{
+				//set pruning threshold of low value checks
+				prune_threshold = atof(line);
+			}
+			else if(count == 12)
+			{
+				//set check timing on or off
+				measure_checks = atoi(line);
+			}
+			else if(count == 13)
+			{
+				//set runtime bitcode
+				strcpy(p_runtime_file, line);
+			}
+			else if(count == 14)
+			{
+				//set list of functions checked per call
+				strcpy(p_coarse_file, line);
+			}
+			else if(count == 15)
+			{
+				//set how blocks are keyed
+				site_keys = atoi(line);
+			}
+			else if(count == 16)
+			{
+				//set sampling period of checks
+				sample_period = atol(line);
+			}
+			else if(count == 17)
+			{
+				//set random sampling on or off
+				sample_random = atoi(line);
+			}
+			else if(count == 18)
+			{
+				//set overhead budget of the checks
+				overhead_budget = atof(line);
+			}
+			else if(count == 19)
+			{
+				//set cost of one check
+				check_cost = atof(line);
+			}
+			else if(count == 20)
+			{
+				//set code growth limit of tail duplication
+				duplicate_limit = atol(line);
+			}
 
 
 			//printf("%s", line);
@@ -235,6 +662,7 @@ bool TimedExecution::runOnModule(Module &M) {
 	LoadInst *load;
 	LLVMContext &llvm_context = M.getContext();
 	Type *I64Ty = Type::getInt64Ty(llvm_context);
+	Type *I32Ty = Type::getInt32Ty(llvm_context);
 	Type *I8PtrTy = Type::getInt8PtrTy(llvm_context);
 	Type *VoidTy = Type::getVoidTy(llvm_context);
 	Type *DoubleTy = Type::getDoubleTy(llvm_context);
@@ -266,6 +694,7 @@ bool TimedExecution::runOnModule(Module &M) {
 	Value *instru_set_loop_false_f = M.getOrInsertFunction("set_infinite_loop_flag_false", VoidTy, I64Ty, nullptr);
 	//Value *instru_print_time_f = M.getOrInsertFunction("instrument_function_print_time", VoidTy, I64Ty, nullptr);
 	Value *instru_dump_rdtsc_result_f = M.getOrInsertFunction("instrument_function_dump_rdtsc_result", I64Ty, I64Ty, nullptr);
+	Value *instru_dump_check_cycles_f = M.getOrInsertFunction("instrument_function_dump_check_cycles", I64Ty, I64Ty, nullptr);
 
 	Constant *initial_value_int_zero = ConstantInt::get(I64Ty, 0);
 	Constant *initial_value_int_one = ConstantInt::get(I64Ty, 1);
@@ -287,6 +716,19 @@ bool TimedExecution::runOnModule(Module &M) {
 	gv = new GlobalVariable(M, I64Ty, false, GlobalValue::AvailableExternallyLinkage, 0, "pre_bb_num");
 	gv->setInitializer(initial_value_int_zero);
 
+	//site ids handed out by the modules compiled before
+	loadSiteSymbols(currentd);
+
+	//bodies of the runtime calls for the optimizer
+	if(p_runtime_file[0] != '\0')
+		linkRuntime(M, currentd);
+
+	//one context per copy of small merge blocks, same CFG for training and detection
+	duplicateTails(M);
+
+	//names of the blocks, before any of them is split
+	labelBlocks(M);
+
 	
 
 
@@ -311,6 +753,7 @@ bool TimedExecution::runOnModule(Module &M) {
 	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
 	{
 		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
 		//errs() << F->getName() << "\n";
 
 		for(Function::iterator FI = MI->begin(), FE = MI->end(); FI != FE; FI++)
@@ -330,7 +773,7 @@ bool TimedExecution::runOnModule(Module &M) {
 			}
 			int type1 = -1, type2 = -1;
 
-			if((num_pred > 1) || (strcmp(BB->getName().str().c_str(), "entry") == 0) || has_return_inst)
+			if((num_pred > 1) || tail_copies.count(BB) || (strcmp(blockName(BB).c_str(), "entry") == 0) || has_return_inst)
 				type2 = 1;
 
 			for(succ_iterator SI = succ_begin(BB), E = succ_end(BB); SI != E; SI++)
@@ -348,7 +791,7 @@ bool TimedExecution::runOnModule(Module &M) {
 						has_return_inst = 1;
 					}
 				}
-				if((num_pred > 1) || (strcmp(BBB->getName().str().c_str(), "entry") == 0) || has_return_inst)
+				if((num_pred > 1) || tail_copies.count(BBB) || (strcmp(blockName(BBB).c_str(), "entry") == 0) || has_return_inst)
 					type1 = 1;
 			}
 			FILE *file;
@@ -356,7 +799,7 @@ bool TimedExecution::runOnModule(Module &M) {
 			strcpy(tgtemp, currentd);
 			strcat(tgtemp, "/tgdata.txt");
 			file = fopen(tgtemp, "a");
-			fprintf(file, "%s\n%s\n%d\n%d\n",F->getName().str().c_str(),BB->getName().str().c_str(),type1, type2);
+			fprintf(file, "%s\n%s\n%d\n%d\n",F->getName().str().c_str(),blockName(BB).c_str(),type1, type2);
 			fclose(file);
 		}
 	}
@@ -382,6 +825,7 @@ bool TimedExecution::runOnModule(Module &M) {
 	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
 	{
 		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
 		//if(strstr((char *)F->getName().str().c_str(), "instrument_function") != NULL)errs() << F->getName() << "\n";
 
 		int bb_count =0;
@@ -409,7 +853,7 @@ bool TimedExecution::runOnModule(Module &M) {
 			}
 
 			//type 2 nodes
-			if((num_pred > 1) || (strcmp(BB->getName().str().c_str(), "entry") == 0) || has_return_inst)
+			if((num_pred > 1) || tail_copies.count(BB) || (strcmp(blockName(BB).c_str(), "entry") == 0) || has_return_inst)
 			{
 				//get time before our time consuming process
 				gv = M.getGlobalVariable(StringRef("current_time"), true);
@@ -421,7 +865,7 @@ bool TimedExecution::runOnModule(Module &M) {
 				Value *sub = IRB.CreateSub(load, last_time_load);
 
 				Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-				Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+				Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 
 				Value *args[] = {str_para1, str_para2, sub};
 				//insert record
@@ -438,7 +882,7 @@ bool TimedExecution::runOnModule(Module &M) {
 			{
 				//insert a -1 value
 				Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-				Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+				Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 				Value *args[] = {str_para1, str_para2, initial_value_int_minus_one};
 				IRB.CreateCall(instru_insert_record_f, args);
 			}
@@ -533,6 +977,7 @@ bool TimedExecution::runOnModule(Module &M) {
 
 
 	//----------------------Mode 1 for detection logic instrumentation---------------------------//
+	//sites with more than 2 contexts, past detect1..2, are checked by instrument_function_detect with the same b and c
 	if(mode == 1)
 	{
 
@@ -856,6 +1301,7 @@ bool TimedExecution::runOnModule(Module &M) {
 	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
 	{
 		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
 		char* function_name = (char*)malloc(60);
 		strcpy(function_name, F->getName().str().c_str());
 		int bb_count =0;
@@ -863,7 +1309,7 @@ bool TimedExecution::runOnModule(Module &M) {
 		{	
 			BasicBlock *BB = FI;
 			char* bb_name = (char*)malloc(180);
-			strcpy(bb_name, BB->getName().str().c_str());
+			strcpy(bb_name, blockName(BB).c_str());
 			IRBuilder<> IRB(BB->getTerminator());
 			//errs() << function_name << " " << bb_name << "\n";
 			int type1 = -1, type2 = -1;
@@ -1028,6 +1474,19 @@ bool TimedExecution::runOnModule(Module &M) {
 					c_vector3.push_back(*myit1 + page_fault_average - *myit2 - page_fault_stdev);
 					myit1++; myit2++;
 				}
+				//detect1..2 stop at 2 contexts, the table driven check takes the interval first
+				if(vector_size > 2)
+				{
+					struct site_model detect_sm;
+					for(my_i = 0; my_i < vector_size; my_i++)
+					{
+						struct context_model cm;
+						cm.bb_num = bb_num_vector2[my_i];
+						detect_sm.contexts.push_back(cm);
+					}
+					IRBuilder<> IRB(last_time_load);
+					emitDetectCall(IRB, BB, detect_sm, b_vector3, c_vector3);
+				}
 				//print for debugging, b_vector3 and c_vector3
 				std::vector<double>::iterator mybit = b_vector3.begin();
 				std::vector<double>::iterator mycit = c_vector3.begin();
@@ -1048,7 +1507,7 @@ bool TimedExecution::runOnModule(Module &M) {
 					Constant *mybit_value_int = ConstantInt::get(I64Ty, *mybit);
 					Constant *mycit_value_int = ConstantInt::get(I64Ty, *mycit);
 					Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-					Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+					Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 					Value *args[] = {load, detect_result_sub_inst, last_time_load, curr, myit_value_int, mybit_value_int, mycit_value_int, str_para1, str_para2};
 					IRB.CreateCall(instru_detect1_f, args);
 				}
@@ -1061,7 +1520,7 @@ bool TimedExecution::runOnModule(Module &M) {
 					Constant *mybit1_value_int = ConstantInt::get(I64Ty, *(mybit+1));
 					Constant *mycit1_value_int = ConstantInt::get(I64Ty, *(mycit+1));
 					Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-					Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+					Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 					Value *args[] = {load, detect_result_sub_inst, last_time_load, curr, myit_value_int, mybit_value_int, mycit_value_int,
 								myit1_value_int, mybit1_value_int, mycit1_value_int, str_para1, str_para2};
 					IRB.CreateCall(instru_detect2_f, args);
@@ -1191,7 +1650,7 @@ bool TimedExecution::runOnModule(Module &M) {
 					Constant *mybit_value_int = ConstantInt::get(I64Ty, *mybit);
 					Constant *mycit_value_int = ConstantInt::get(I64Ty, *mycit);
 					Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-					Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+					Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 					Value *args[] = {load, detect_result_sub_inst, last_time_load, curr, myit_value_int, mybit_value_int, mycit_value_int, str_para1, str_para2};
 					IRBuilder<> IRB(BB->getTerminator());
 					IRB.CreateCall(instru_detect1_f, args);
@@ -1205,7 +1664,7 @@ bool TimedExecution::runOnModule(Module &M) {
 					Constant *mybit1_value_int = ConstantInt::get(I64Ty, *(mybit+1));
 					Constant *mycit1_value_int = ConstantInt::get(I64Ty, *(mycit+1));
 					Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-					Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+					Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 					Value *args[] = {load, detect_result_sub_inst, last_time_load, curr, myit_value_int, mybit_value_int, mycit_value_int,
 								myit1_value_int, mybit1_value_int, mycit1_value_int, str_para1, str_para2};
 					IRBuilder<> IRB(BB->getTerminator());
@@ -1387,6 +1846,7 @@ bool TimedExecution::runOnModule(Module &M) {
 	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
 	{
 		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
 		//errs() << F->getName() << "\n";
 
 		int bb_count =0;
@@ -1414,7 +1874,7 @@ bool TimedExecution::runOnModule(Module &M) {
 			}
 
 			//type 2 nodes
-			if((num_pred > 1) || (strcmp(BB->getName().str().c_str(), "entry") == 0) || has_return_inst)
+			if((num_pred > 1) || tail_copies.count(BB) || (strcmp(blockName(BB).c_str(), "entry") == 0) || has_return_inst)
 			{
 				//get time before our time consuming process
 				gv = M.getGlobalVariable(StringRef("current_time"), true);
@@ -1426,7 +1886,7 @@ bool TimedExecution::runOnModule(Module &M) {
 				Value *sub = IRB.CreateSub(load, last_time_load);
 
 				Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-				Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+				Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 
 				Value *args[] = {str_para1, str_para2, sub};
 				//insert record
@@ -1445,7 +1905,7 @@ bool TimedExecution::runOnModule(Module &M) {
 			{
 				//insert a -1 value
 				/*Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-				Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+				Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 				Value *args[] = {str_para1, str_para2, initial_value_int_minus_one};
 				IRB.CreateCall(instru_insert_record_f, args);*/
 			}
@@ -1565,6 +2025,7 @@ bool TimedExecution::runOnModule(Module &M) {
 	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
 	{
 		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
 		//errs() << F->getName() << "\n";
 
 		if((strcmp(F->getName().str().c_str(), p_entry_function) == 0) && (M.getFunction(p_reference_function) != NULL))
@@ -1674,6 +2135,7 @@ bool TimedExecution::runOnModule(Module &M) {
 	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
 	{
 		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
 		//errs() << F->getName() << "\n";
 
 		if(strcmp(F->getName().str().c_str(), "main") == 0)
@@ -1894,6 +2356,7 @@ bool TimedExecution::runOnModule(Module &M) {
 	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
 	{
 		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
 		//errs() << F->getName() << "\n";
 
 		int bb_count =0;
@@ -1921,7 +2384,7 @@ bool TimedExecution::runOnModule(Module &M) {
 			}
 
 			//type 2 nodes
-			if((num_pred > 1) || (strcmp(BB->getName().str().c_str(), "entry") == 0) || has_return_inst)
+			if((num_pred > 1) || tail_copies.count(BB) || (strcmp(blockName(BB).c_str(), "entry") == 0) || has_return_inst)
 			{
 				Value *get_time_f = M.getOrInsertFunction("get_time", I64Ty, I64Ty, nullptr);
 				Value *insert_real_time_f = M.getOrInsertFunction("insert_real_time", VoidTy, I64Ty, nullptr);
@@ -1948,7 +2411,7 @@ bool TimedExecution::runOnModule(Module &M) {
 			{
 				//insert a -1 value
 				Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-				Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+				Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 				Value *args[] = {str_para1, str_para2, initial_value_int_minus_one};
 				IRB.CreateCall(instru_insert_record_f, args);
 			}
@@ -2050,6 +2513,7 @@ bool TimedExecution::runOnModule(Module &M) {
 	//----------------------Mode 6 for detection logic instrumentation---------------------------//
 
 	//optimized for performance, copied from mode 1
+	//sites with more than 2 contexts, past detect1..2, are checked by instrument_function_detect with the same b and c
 
 	if(mode == 6)
 	{
@@ -2455,6 +2919,7 @@ bool TimedExecution::runOnModule(Module &M) {
 	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
 	{
 		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
 		char* function_name = (char*)malloc(60);
 		strcpy(function_name, F->getName().str().c_str());
 		int bb_count =0;
@@ -2462,7 +2927,7 @@ bool TimedExecution::runOnModule(Module &M) {
 		{	
 			BasicBlock *BB = FI;
 			char* bb_name = (char*)malloc(180);
-			strcpy(bb_name, BB->getName().str().c_str());
+			strcpy(bb_name, blockName(BB).c_str());
 			IRBuilder<> IRB(BB->getTerminator());
 			//errs() << function_name << " " << bb_name << "\n";
 			int type1 = -1, type2 = -1;
@@ -2627,6 +3092,19 @@ bool TimedExecution::runOnModule(Module &M) {
 					c_vector3.push_back(*myit1 + page_fault_average - *myit2 - page_fault_stdev);
 					myit1++; myit2++;
 				}
+				//detect1..2 stop at 2 contexts, the table driven check takes the interval first
+				if(vector_size > 2)
+				{
+					struct site_model detect_sm;
+					for(my_i = 0; my_i < vector_size; my_i++)
+					{
+						struct context_model cm;
+						cm.bb_num = bb_num_vector2[my_i];
+						detect_sm.contexts.push_back(cm);
+					}
+					IRBuilder<> IRB(last_time_load);
+					emitDetectCall(IRB, BB, detect_sm, b_vector3, c_vector3);
+				}
 				//print for debugging, b_vector3 and c_vector3
 				std::vector<double>::iterator mybit = b_vector3.begin();
 				std::vector<double>::iterator mycit = c_vector3.begin();
@@ -2647,7 +3125,7 @@ bool TimedExecution::runOnModule(Module &M) {
 					Constant *mybit_value_int = ConstantInt::get(I64Ty, *mybit);
 					Constant *mycit_value_int = ConstantInt::get(I64Ty, *mycit);
 					Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-					Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+					Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 					Value *args[] = {load, detect_result_sub_inst, last_time_load, curr, myit_value_int, mybit_value_int, mycit_value_int, str_para1, str_para2};
 					//IRB.CreateCall(instru_detect1_f, args);
 				}
@@ -2660,7 +3138,7 @@ bool TimedExecution::runOnModule(Module &M) {
 					Constant *mybit1_value_int = ConstantInt::get(I64Ty, *(mybit+1));
 					Constant *mycit1_value_int = ConstantInt::get(I64Ty, *(mycit+1));
 					Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-					Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+					Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 					Value *args[] = {load, detect_result_sub_inst, last_time_load, curr, myit_value_int, mybit_value_int, mycit_value_int,
 								myit1_value_int, mybit1_value_int, mycit1_value_int, str_para1, str_para2};
 					//IRB.CreateCall(instru_detect2_f, args);
@@ -2790,7 +3268,7 @@ bool TimedExecution::runOnModule(Module &M) {
 					Constant *mybit_value_int = ConstantInt::get(I64Ty, *mybit);
 					Constant *mycit_value_int = ConstantInt::get(I64Ty, *mycit);
 					Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-					Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+					Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 					Value *args[] = {load, detect_result_sub_inst, last_time_load, curr, myit_value_int, mybit_value_int, mycit_value_int, str_para1, str_para2};
 					IRBuilder<> IRB(BB->getTerminator());
 					IRB.CreateCall(instru_detect1_f, args);
@@ -2804,7 +3282,7 @@ bool TimedExecution::runOnModule(Module &M) {
 					Constant *mybit1_value_int = ConstantInt::get(I64Ty, *(mybit+1));
 					Constant *mycit1_value_int = ConstantInt::get(I64Ty, *(mycit+1));
 					Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-					Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+					Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 					Value *args[] = {load, detect_result_sub_inst, last_time_load, curr, myit_value_int, mybit_value_int, mycit_value_int,
 								myit1_value_int, mybit1_value_int, mycit1_value_int, str_para1, str_para2};
 					IRBuilder<> IRB(BB->getTerminator());
@@ -2969,6 +3447,7 @@ bool TimedExecution::runOnModule(Module &M) {
 	//optimized for performance, copied from mode 6
 
 	//optimized for performance, copied from mode 1
+	//sites with more than 4 contexts, past detect1..4, are checked by instrument_function_detect with the same b and c
 
 	if(mode == 7)
 	{
@@ -3380,6 +3859,7 @@ bool TimedExecution::runOnModule(Module &M) {
 	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
 	{
 		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
 		char* function_name = (char*)malloc(60);
 		strcpy(function_name, F->getName().str().c_str());
 		int bb_count =0;
@@ -3387,7 +3867,7 @@ bool TimedExecution::runOnModule(Module &M) {
 		{	
 			BasicBlock *BB = FI;
 			char* bb_name = (char*)malloc(180);
-			strcpy(bb_name, BB->getName().str().c_str());
+			strcpy(bb_name, blockName(BB).c_str());
 			IRBuilder<> IRB(BB->getTerminator());
 			//errs() << function_name << " " << bb_name << "\n";
 			int type1 = -1, type2 = -1;
@@ -3580,6 +4060,19 @@ bool TimedExecution::runOnModule(Module &M) {
 					c_vector3.push_back(*myit1 + page_fault_average - *myit2 - page_fault_stdev);
 					myit1++; myit2++;
 				}
+				//detect1..4 stop at 4 contexts, the table driven check takes the interval first
+				if(vector_size > 4)
+				{
+					struct site_model detect_sm;
+					for(my_i = 0; my_i < vector_size; my_i++)
+					{
+						struct context_model cm;
+						cm.bb_num = bb_num_vector2[my_i];
+						detect_sm.contexts.push_back(cm);
+					}
+					IRBuilder<> IRB(last_time_load);
+					emitDetectCall(IRB, BB, detect_sm, b_vector3, c_vector3);
+				}
 
 				//errs() << "page_fault_average: " << page_fault_average << "page_fault_stdev: " << page_fault_stdev << "\n";
 
@@ -3652,7 +4145,7 @@ bool TimedExecution::runOnModule(Module &M) {
 
 					//errs() << "*mycit: " << *mycit << "\n";
 					Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-					Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+					Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 					Value *args[] = {load, detect_result_sub_inst, last_time_load, curr, myit_value_int, mybit_value_int, mycit_value_int, str_para1, str_para2};
 					//Value *args[] = {load, detect_result_sub_inst, last_time_load, curr, myit_value_int, mybit_value_double, mycit_value_double, str_para1, str_para2};
 
@@ -3669,7 +4162,7 @@ bool TimedExecution::runOnModule(Module &M) {
 					Constant *mybit1_value_int = ConstantInt::get(I64Ty, *(mybit+1));
 					Constant *mycit1_value_int = ConstantInt::get(I64Ty, *(mycit+1));
 					Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-					Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+					Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 					Value *args[] = {load, detect_result_sub_inst, last_time_load, curr, myit_value_int, mybit_value_int, mycit_value_int,
 								myit1_value_int, mybit1_value_int, mycit1_value_int, str_para1, str_para2};
 					//IRBuilder<> IRB(newBB2->getTerminator());
@@ -3688,7 +4181,7 @@ bool TimedExecution::runOnModule(Module &M) {
 					Constant *mybit2_value_int = ConstantInt::get(I64Ty, *(mybit+2));
 					Constant *mycit2_value_int = ConstantInt::get(I64Ty, *(mycit+2));
 					Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-					Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+					Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 					Value *args[] = {load, detect_result_sub_inst, last_time_load, curr, myit_value_int, mybit_value_int, mycit_value_int,
 								myit1_value_int, mybit1_value_int, mycit1_value_int,
 								myit2_value_int, mybit2_value_int, mycit2_value_int, str_para1, str_para2};
@@ -3711,7 +4204,7 @@ bool TimedExecution::runOnModule(Module &M) {
 					Constant *mybit3_value_int = ConstantInt::get(I64Ty, *(mybit+3));
 					Constant *mycit3_value_int = ConstantInt::get(I64Ty, *(mycit+3));
 					Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-					Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+					Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 					Value *args[] = {load, detect_result_sub_inst, last_time_load, curr, myit_value_int, mybit_value_int, mycit_value_int,
 								myit1_value_int, mybit1_value_int, mycit1_value_int,
 								myit2_value_int, mybit2_value_int, mycit2_value_int,
@@ -3726,7 +4219,7 @@ bool TimedExecution::runOnModule(Module &M) {
 				Constant *mybit_value_int = ConstantInt::get(I64Ty, 2);
 				Constant *mycit_value_int = ConstantInt::get(I64Ty, 3);
 				Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-				Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+				Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 				Value *args[] = {myit_value_int, myit_value_int, myit_value_int, myit_value_int, myit_value_int, mybit_value_int, mycit_value_int, str_para1, str_para2};
 				////IRBuilder<> IRB2(newBB2->getTerminator());
 				//IRB2.CreateCall(instru_detect1_f, args);
@@ -3880,6 +4373,7 @@ bool TimedExecution::runOnModule(Module &M) {
 		for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
 		{
 		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
 		char* function_name = (char*)malloc(60);
 		strcpy(function_name, F->getName().str().c_str());
 		//handle ecall entry and exit
@@ -3967,11 +4461,27 @@ bool TimedExecution::runOnModule(Module &M) {
 	//----------------------Mode 9 for detection logic instrumentation with various factor---------------------------//
 
 	//optimized for performance, copied from mode 7
+	//per site factors calibrated by mode 18 in ./tfactordata.txt take the place of tfactor when present,
+	//they apply to the c mode 18 calibrated: from the training part of its split, at least 1
+	//sites with more than 2 contexts, past the inline compares, are checked by instrument_function_detect with the same b and c
 
 
 	if(mode == 9)
 	{
 	errs() << "tfactor -----> " << tfactor << "\n";
+	llvm::StringMap<double> factor_map;
+	loadSiteFactors(currentd, factor_map);
+	llvm::StringMap<struct site_model> calibration_map;
+	if(!factor_map.empty())
+	{
+		loadTraceList(currentd);
+		std::vector<struct trace_info> train_list, heldout_list;
+		splitHeldout(train_list, heldout_list);
+		llvm::StringMap<int> calibration_type1_map;
+		trace_list = train_list;
+		buildSiteModels(calibration_map, calibration_type1_map);
+		trace_list.clear();
+	}
 
 	FILE *ttracefile;
 	char ttracetemp[300];
@@ -4318,37 +4828,37 @@ bool TimedExecution::runOnModule(Module &M) {
 		{
 			//leave out last character '\n'
 			line[read-1] = '\0';
-			if(count % 4 == 0)
+			if(count % 6 == 0)
 			{
 				//function name
 				ti = (struct trace_info*) malloc (sizeof(struct trace_info));
 				ti->function_name = (char *) malloc(300);
 				strcpy(ti->function_name, line);
 			}
-			else if(count % 4 == 1)
+			else if(count % 6 == 1)
 			{
 				//type2 bb name
 				ti->tail_type2_bb_name = (char *) malloc(300);
 				strcpy(ti->tail_type2_bb_name, line);			
 			}
-			else if(count % 4 == 2)
+			else if(count % 6 == 2)
 			{
 				//context type1 function name
 				ti->context_type1_function_name = (char *) malloc(300);
 				strcpy(ti->context_type1_function_name, line);			
 			}
-			else if(count % 4 == 3)
+			else if(count % 6 == 3)
 			{
 				//context type1 bb name
 				ti->context_type1_bb_name = (char *) malloc(300);
 				strcpy(ti->context_type1_bb_name, line);			
 			}
-			else if(count % 4 == 4)
+			else if(count % 6 == 4)
 			{
 				//context type1 bb num
 				ti->context_type1_bb_num = atoi(line);
 			}
-			else if(count % 4 == 5)
+			else if(count % 6 == 5)
 			{
 				//type2 and bb global num
 				ti->bb_time = atoi(line);
@@ -4375,6 +4885,7 @@ bool TimedExecution::runOnModule(Module &M) {
 	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
 	{
 		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
 		char* function_name = (char*)malloc(60);
 		strcpy(function_name, F->getName().str().c_str());
 		int bb_count =0;
@@ -4382,7 +4893,7 @@ bool TimedExecution::runOnModule(Module &M) {
 		{	
 			BasicBlock *BB = FI;
 			char* bb_name = (char*)malloc(180);
-			strcpy(bb_name, BB->getName().str().c_str());
+			strcpy(bb_name, blockName(BB).c_str());
 			IRBuilder<> IRB(BB->getTerminator());
 			//errs() << function_name << " " << bb_name << "\n";
 			int type1 = -1, type2 = -1;
@@ -4563,10 +5074,34 @@ bool TimedExecution::runOnModule(Module &M) {
 				int my_i;
 				myit1 = average_vector2.begin();
 				myit2 = stdev_vector2.begin();
+				double site_tfactor = tfactor;
+				llvm::StringMap<double>::iterator fit = factor_map.find(std::string(function_name) + bb_name);
+				if(fit != factor_map.end()) site_tfactor = fit->getValue();
 				for(my_i = 0; my_i < vector_size; my_i++)
 				{
 					b_vector3.push_back(*myit1 - *myit2);
-					c_vector3.push_back((*myit1 + page_fault_average - *myit2 - page_fault_stdev) * tfactor);
+					double c = *myit1 + page_fault_average - *myit2 - page_fault_stdev;
+					if(fit != factor_map.end())
+					{
+						//the c the factor was calibrated on
+						struct context_model *train = findContext(calibration_map, std::string(function_name) + bb_name, bb_num_vector2[my_i]);
+						if(train != NULL) c = train->average + page_fault_average - train->stdev - page_fault_stdev;
+						c = std::max(1.0, c);
+					}
+				//more contexts than the inline compares below cover, the table driven check takes the interval first
+				if(vector_size > 2)
+				{
+					struct site_model detect_sm;
+					for(my_i = 0; my_i < vector_size; my_i++)
+					{
+						struct context_model cm;
+						cm.bb_num = bb_num_vector2[my_i];
+						detect_sm.contexts.push_back(cm);
+					}
+					IRBuilder<> IRB(last_time_load);
+					emitDetectCall(IRB, BB, detect_sm, b_vector3, c_vector3);
+				}
+					c_vector3.push_back(c * site_tfactor);
 					myit1++; myit2++;
 				}
 				//print for debugging, b_vector3 and c_vector3
@@ -4629,7 +5164,7 @@ bool TimedExecution::runOnModule(Module &M) {
 					Constant *mybit_value_int = ConstantInt::get(I64Ty, *mybit);
 					Constant *mycit_value_int = ConstantInt::get(I64Ty, *mycit);
 					Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-					Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+					Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 					Value *args[] = {load, detect_result_sub_inst, last_time_load, curr, myit_value_int, mybit_value_int, mycit_value_int, str_para1, str_para2};
 					IRBuilder<> IRB(newBB2->getTerminator());
 					//IRB.CreateCall(instru_detect1_f, args);
@@ -4643,7 +5178,7 @@ bool TimedExecution::runOnModule(Module &M) {
 					Constant *mybit1_value_int = ConstantInt::get(I64Ty, *(mybit+1));
 					Constant *mycit1_value_int = ConstantInt::get(I64Ty, *(mycit+1));
 					Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-					Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+					Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 					Value *args[] = {load, detect_result_sub_inst, last_time_load, curr, myit_value_int, mybit_value_int, mycit_value_int,
 								myit1_value_int, mybit1_value_int, mycit1_value_int, str_para1, str_para2};
 					IRBuilder<> IRB(newBB2->getTerminator());
@@ -4657,7 +5192,7 @@ bool TimedExecution::runOnModule(Module &M) {
 				Constant *mybit_value_int = ConstantInt::get(I64Ty, 2);
 				Constant *mycit_value_int = ConstantInt::get(I64Ty, 3);
 				Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-				Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+				Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 				Value *args[] = {myit_value_int, myit_value_int, myit_value_int, myit_value_int, myit_value_int, mybit_value_int, mycit_value_int, str_para1, str_para2};
 				IRBuilder<> IRB2(newBB2->getTerminator());
 				//IRB2.CreateCall(instru_detect1_f, args);
@@ -4821,6 +5356,7 @@ bool TimedExecution::runOnModule(Module &M) {
 	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
 	{
 		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
 		//errs() << F->getName() << "\n";
 
 		for(Function::iterator FI = MI->begin(), FE = MI->end(); FI != FE; FI++)
@@ -4840,7 +5376,7 @@ bool TimedExecution::runOnModule(Module &M) {
 			}
 			int type1 = -1, type2 = -1;
 
-			if((num_pred > 1) || (strcmp(BB->getName().str().c_str(), "entry") == 0) || has_return_inst)
+			if((num_pred > 1) || tail_copies.count(BB) || (strcmp(blockName(BB).c_str(), "entry") == 0) || has_return_inst)
 			{
 				type2 = 1;
 				t2++;
@@ -4861,7 +5397,7 @@ bool TimedExecution::runOnModule(Module &M) {
 						has_return_inst = 1;
 					}
 				}
-				if((num_pred > 1) || (strcmp(BBB->getName().str().c_str(), "entry") == 0) || has_return_inst)
+				if((num_pred > 1) || tail_copies.count(BBB) || (strcmp(blockName(BBB).c_str(), "entry") == 0) || has_return_inst)
 				{
 					type1 = 1;
 					t1++;
@@ -4947,6 +5483,7 @@ bool TimedExecution::runOnModule(Module &M) {
 	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
 	{
 		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
 		//if(strstr((char *)F->getName().str().c_str(), "instrument_function") != NULL)errs() << F->getName() << "\n";
 
 		int bb_count =0;
@@ -4974,7 +5511,7 @@ bool TimedExecution::runOnModule(Module &M) {
 			}
 
 			//type 2 nodes
-			if((num_pred > 1) || (strcmp(BB->getName().str().c_str(), "entry") == 0) || has_return_inst)
+			if((num_pred > 1) || tail_copies.count(BB) || (strcmp(blockName(BB).c_str(), "entry") == 0) || has_return_inst)
 			{
 
 				IRB.CreateCall(instru_get_time_f, initial_value_int_zero);
@@ -4989,7 +5526,7 @@ bool TimedExecution::runOnModule(Module &M) {
 				Value *sub = IRB.CreateSub(load, last_time_load);
 
 				Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-				Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+				Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 
 				Value *args[] = {str_para1, str_para2, sub};
 				//insert record
@@ -5006,7 +5543,7 @@ bool TimedExecution::runOnModule(Module &M) {
 			{
 				//insert a -1 value
 				Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-				Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+				Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 				Value *args[] = {str_para1, str_para2, initial_value_int_minus_one};
 				//IRB.CreateCall(instru_insert_record_f, args);
 			}
@@ -5103,6 +5640,7 @@ bool TimedExecution::runOnModule(Module &M) {
 	//----------------------Mode 12 for detection logic instrumentation---------------------------//
 
 	//optimized for performance, copied from mode 7
+	//sites with more than 4 contexts, past detect1..4, are checked by instrument_function_detect with the same b and c
 
 
 	if(mode == 12)
@@ -5515,6 +6053,7 @@ bool TimedExecution::runOnModule(Module &M) {
 	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
 	{
 		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
 		char* function_name = (char*)malloc(60);
 		strcpy(function_name, F->getName().str().c_str());
 		int bb_count =0;
@@ -5522,7 +6061,7 @@ bool TimedExecution::runOnModule(Module &M) {
 		{	
 			BasicBlock *BB = FI;
 			char* bb_name = (char*)malloc(180);
-			strcpy(bb_name, BB->getName().str().c_str());
+			strcpy(bb_name, blockName(BB).c_str());
 			IRBuilder<> IRB(BB->getTerminator());
 			//errs() << function_name << " " << bb_name << "\n";
 			int type1 = -1, type2 = -1;
@@ -5715,6 +6254,19 @@ bool TimedExecution::runOnModule(Module &M) {
 					c_vector3.push_back(*myit1 + page_fault_average - *myit2 - page_fault_stdev);
 					myit1++; myit2++;
 				}
+				//detect1..4 stop at 4 contexts, the table driven check takes the interval first
+				if(vector_size > 4)
+				{
+					struct site_model detect_sm;
+					for(my_i = 0; my_i < vector_size; my_i++)
+					{
+						struct context_model cm;
+						cm.bb_num = bb_num_vector2[my_i];
+						detect_sm.contexts.push_back(cm);
+					}
+					IRBuilder<> IRB(last_time_load);
+					emitDetectCall(IRB, BB, detect_sm, b_vector3, c_vector3);
+				}
 
 				//errs() << "page_fault_average: " << page_fault_average << "page_fault_stdev: " << page_fault_stdev << "\n";
 
@@ -5787,7 +6339,7 @@ bool TimedExecution::runOnModule(Module &M) {
 
 					//errs() << "*mycit: " << *mycit << "\n";
 					Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-					Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+					Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 					Value *args[] = {load, detect_result_sub_inst, last_time_load, curr, myit_value_int, mybit_value_int, mycit_value_int, str_para1, str_para2};
 					//Value *args[] = {load, detect_result_sub_inst, last_time_load, curr, myit_value_int, mybit_value_double, mycit_value_double, str_para1, str_para2};
 
@@ -5804,7 +6356,7 @@ bool TimedExecution::runOnModule(Module &M) {
 					Constant *mybit1_value_int = ConstantInt::get(I64Ty, *(mybit+1));
 					Constant *mycit1_value_int = ConstantInt::get(I64Ty, *(mycit+1));
 					Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-					Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+					Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 					Value *args[] = {load, detect_result_sub_inst, last_time_load, curr, myit_value_int, mybit_value_int, mycit_value_int,
 								myit1_value_int, mybit1_value_int, mycit1_value_int, str_para1, str_para2};
 					//IRBuilder<> IRB(newBB2->getTerminator());
@@ -5823,7 +6375,7 @@ bool TimedExecution::runOnModule(Module &M) {
 					Constant *mybit2_value_int = ConstantInt::get(I64Ty, *(mybit+2));
 					Constant *mycit2_value_int = ConstantInt::get(I64Ty, *(mycit+2));
 					Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-					Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+					Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 					Value *args[] = {load, detect_result_sub_inst, last_time_load, curr, myit_value_int, mybit_value_int, mycit_value_int,
 								myit1_value_int, mybit1_value_int, mycit1_value_int,
 								myit2_value_int, mybit2_value_int, mycit2_value_int, str_para1, str_para2};
@@ -5846,7 +6398,7 @@ bool TimedExecution::runOnModule(Module &M) {
 					Constant *mybit3_value_int = ConstantInt::get(I64Ty, *(mybit+3));
 					Constant *mycit3_value_int = ConstantInt::get(I64Ty, *(mycit+3));
 					Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-					Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+					Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 					Value *args[] = {load, detect_result_sub_inst, last_time_load, curr, myit_value_int, mybit_value_int, mycit_value_int,
 								myit1_value_int, mybit1_value_int, mycit1_value_int,
 								myit2_value_int, mybit2_value_int, mycit2_value_int,
@@ -5861,7 +6413,7 @@ bool TimedExecution::runOnModule(Module &M) {
 				Constant *mybit_value_int = ConstantInt::get(I64Ty, 2);
 				Constant *mycit_value_int = ConstantInt::get(I64Ty, 3);
 				Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-				Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+				Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 				Value *args[] = {myit_value_int, myit_value_int, myit_value_int, myit_value_int, myit_value_int, mybit_value_int, mycit_value_int, str_para1, str_para2};
 				////IRBuilder<> IRB2(newBB2->getTerminator());
 				//IRB2.CreateCall(instru_detect1_f, args);
@@ -6419,6 +6971,7 @@ bool TimedExecution::runOnModule(Module &M) {
 	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
 	{
 		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
 		char* function_name = (char*)malloc(60);
 		strcpy(function_name, F->getName().str().c_str());
 		int bb_count =0;
@@ -6426,7 +6979,7 @@ bool TimedExecution::runOnModule(Module &M) {
 		{	
 			BasicBlock *BB = FI;
 			char* bb_name = (char*)malloc(180);
-			strcpy(bb_name, BB->getName().str().c_str());
+			strcpy(bb_name, blockName(BB).c_str());
 			IRBuilder<> IRB(BB->getTerminator());
 			//errs() << function_name << " " << bb_name << "\n";
 			int type1 = -1, type2 = -1;
@@ -6656,7 +7209,7 @@ bool TimedExecution::runOnModule(Module &M) {
 
 					//errs() << "*mycit: " << *mycit << "\n";
 					Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-					Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+					Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 					Value *args[] = {load, detect_result_sub_inst, last_time_load, curr, myit_value_int, mybit_value_int, mycit_value_int, str_para1, str_para2};
 					//Value *args[] = {load, detect_result_sub_inst, last_time_load, curr, myit_value_int, mybit_value_double, mycit_value_double, str_para1, str_para2};
 
@@ -6673,7 +7226,7 @@ bool TimedExecution::runOnModule(Module &M) {
 					Constant *mybit1_value_int = ConstantInt::get(I64Ty, *(mybit+1));
 					Constant *mycit1_value_int = ConstantInt::get(I64Ty, *(mycit+1));
 					Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-					Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+					Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 					Value *args[] = {load, detect_result_sub_inst, last_time_load, curr, myit_value_int, mybit_value_int, mycit_value_int,
 								myit1_value_int, mybit1_value_int, mycit1_value_int, str_para1, str_para2};
 					//IRBuilder<> IRB(newBB2->getTerminator());
@@ -6692,7 +7245,7 @@ bool TimedExecution::runOnModule(Module &M) {
 					Constant *mybit2_value_int = ConstantInt::get(I64Ty, *(mybit+2));
 					Constant *mycit2_value_int = ConstantInt::get(I64Ty, *(mycit+2));
 					Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-					Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+					Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 					Value *args[] = {load, detect_result_sub_inst, last_time_load, curr, myit_value_int, mybit_value_int, mycit_value_int,
 								myit1_value_int, mybit1_value_int, mycit1_value_int,
 								myit2_value_int, mybit2_value_int, mycit2_value_int, str_para1, str_para2};
@@ -6715,7 +7268,7 @@ bool TimedExecution::runOnModule(Module &M) {
 					Constant *mybit3_value_int = ConstantInt::get(I64Ty, *(mybit+3));
 					Constant *mycit3_value_int = ConstantInt::get(I64Ty, *(mycit+3));
 					Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-					Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+					Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 					Value *args[] = {load, detect_result_sub_inst, last_time_load, curr, myit_value_int, mybit_value_int, mycit_value_int,
 								myit1_value_int, mybit1_value_int, mycit1_value_int,
 								myit2_value_int, mybit2_value_int, mycit2_value_int,
@@ -6730,7 +7283,7 @@ bool TimedExecution::runOnModule(Module &M) {
 				Constant *mybit_value_int = ConstantInt::get(I64Ty, 2);
 				Constant *mycit_value_int = ConstantInt::get(I64Ty, 3);
 				Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-				Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
+				Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 				Value *args[] = {myit_value_int, myit_value_int, myit_value_int, myit_value_int, myit_value_int, mybit_value_int, mycit_value_int, str_para1, str_para2};
 				////IRBuilder<> IRB2(newBB2->getTerminator());
 				//IRB2.CreateCall(instru_detect1_f, args);
@@ -6876,876 +7429,4216 @@ bool TimedExecution::runOnModule(Module &M) {
 
 	//----------------------Mode 14 for histogram---------------------------//
 
-	//optimized for performance, copied from mode 13
-
-
-	if(mode == 13)
-	{
-	FILE *ttracefile;
-	char ttracetemp[300];
-	strcpy(ttracetemp, currentd);
-	strcat(ttracetemp, "/ttracedata.txt");
+	/**
+		copied from mode 15, each (site, context) gets a TE_HIST_BINS bin histogram of log2 scaled deltas
+		bin 0 holds delta 0, bin k holds [2^(k-1), 2^k), the last bin holds everything above
+		every bin is stored as a one byte score, -log2 of its smoothed probability in 1/16 units,
+		bins above the largest observed one are out of range and saturate at 255, the smoothing would
+		otherwise keep them under the limit when a context has only a few samples
+		the runtime reports a delta if the score of its bin is above -log2(1 - q) in the same units,
+		capped at 254 so an out of range bin always reports, q is the quantile on line 9 of tconfig.txt
+		the contexts are open addressed by siteHash in 2^hash_bits slots, at most half of them used,
+		so the runtime finds the row of a context with one hashed lookup instead of a scan
+		the tables are private constants in the module, contexts as i64 and scores as i8, one row per slot
+	*/
 
-	//if file does not exist
-	if(access(ttracetemp, 0) == -1)
+	if(mode == 14)
 	{
-	//-------------------processing tgdata.txt-----------------//
-	//map for quick access
-	llvm::StringMap<struct bb_num_s*> bbmap;
+	Type *I64PtrTy = Type::getInt64PtrTy(llvm_context);
+	Value *instru_detect_histogram_f = M.getOrInsertFunction("instrument_function_detect_histogram", VoidTy, I64Ty, I64Ty, I64PtrTy, I8PtrTy, I64Ty, I64Ty, I32Ty, nullptr);
+	long histogram_limit = (long)(-log2(1 - quantile) * 16);
+	if(histogram_limit > 254) histogram_limit = 254;
+	errs() << "histogram limit -----> " << histogram_limit << "\n";
 
-	int longest_f = 0, longest_bb = 0;
+	llvm::StringMap<struct site_model> site_map;
+	llvm::StringMap<int> type1_map;
+	loadTraceList(currentd);
+	buildSiteModels(site_map, type1_map);
+	llvm::StringMap<double> static_map;
+	estimateStaticSites(M, currentd, site_map, static_map);
+	trace_list.clear();
+	llvm::StringMap<int> reset_map;
+	pruneSiteModels(currentd, site_map, reset_map);
 
-	//get global bb_num, type1, type2
-	FILE *gbfile;
-	char tgtemp3[300];
-	strcpy(tgtemp3, currentd);
-	strcat(tgtemp3, "/tgdata.txt");
-	gbfile = fopen(tgtemp3, "r");
-	if(gbfile)
+	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
 	{
-		char *line = NULL;
-		size_t len = 0;
-		ssize_t read;
-		int count = 0;
-		struct bb_num_s *ti;
-		while((read = getline(&line, &len, gbfile)) != -1)
+		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
+		for(Function::iterator FI = MI->begin(), FE = MI->end(); FI != FE; FI++)
 		{
-			//leave out last character '\n'
-			line[read-1] = '\0';
-			if(count % 4 == 0)
-			{
-				//function name
-				ti = (struct bb_num_s*) malloc (sizeof(struct bb_num_s));
-				ti->function_name = (char *) malloc(300);
-				strcpy(ti->function_name, line);
-			}
-			else if(count % 4 == 1)
-			{
-				//bb name
-				ti->bb_name = (char *) malloc(300);
-				strcpy(ti->bb_name, line);			
-			}
-			else if(count % 4 == 2)
-			{
-				//type1
-				ti->type1 = atoi(line);
+			BasicBlock *BB = FI;
+			std::string key = F->getName().str() + blockName(BB);
+
+			//instrument type2 first
+			llvm::StringMap<struct site_model>::iterator sit = site_map.find(key);
+			if(sit != site_map.end())
+			{
+				struct site_model &sm = sit->getValue();
+				int hash_bits = 1;
+				while((1UL << hash_bits) < 2 * sm.contexts.size()) hash_bits++;
+				size_t slots = 1UL << hash_bits;
+				std::vector<uint64_t> ctx_table(slots, TE_TABLE_EMPTY);
+				std::vector<uint8_t> hist_table(slots * TE_HIST_BINS, 255);
+				for(std::vector<struct context_model>::iterator cit = sm.contexts.begin(); cit != sm.contexts.end(); cit++)
+				{
+					double bins[TE_HIST_BINS] = {0};
+					int top = 0;
+					for(std::vector<unsigned long>::iterator myit = cit->samples.begin(); myit != cit->samples.end(); myit++)
+					{
+						int bin = 0;
+						for(unsigned long delta = *myit; delta != 0 && bin < TE_HIST_BINS - 1; delta >>= 1)
+							bin++;
+						bins[bin]++;
+						if(bin > top) top = bin;
+					}
+					size_t slot;
+					for(slot = siteHash(cit->bb_num, hash_bits); ctx_table[slot] != TE_TABLE_EMPTY; slot = (slot + 1) & (slots - 1));
+					ctx_table[slot] = cit->bb_num;
+					errs() << "prior bb num: " << cit->bb_num << " slot: " << slot << " scores:";
+					for(int bin = 0; bin < TE_HIST_BINS; bin++)
+					{
+						double p = (bins[bin] + 0.5) / (cit->samples.size() + 0.5 * TE_HIST_BINS);
+						double score = -log2(p) * 16;
+						//out of range, never seen in training
+						if(bin > top) score = 255;
+						hist_table[slot * TE_HIST_BINS + bin] = score > 255 ? 255 : (uint8_t)score;
+						errs() << " " << (int)hist_table[slot * TE_HIST_BINS + bin];
+					}
+					errs() << "\n";
+				}
+
+				IRBuilder<> IRB1(BB->getTerminator());
+				gv = M.getGlobalVariable(StringRef("current_time"), true);
+				load = IRB1.CreateLoad(gv);
+				gv = M.getGlobalVariable(StringRef("previous_time"), true);
+				LoadInst *last_time_load = IRB1.CreateLoad(gv);
+				IRB1.CreateStore(load, gv);
+				Value *detect_result_sub_inst = IRB1.CreateSub(load, last_time_load);
+				gv = M.getGlobalVariable(StringRef("pre_bb_num"), true);
+				load = IRB1.CreateLoad(gv);
+
+				Constant *ctx_para = createTableArg(ConstantDataArray::get(llvm_context, ctx_table), F, ".te_hist_ctx");
+				Constant *hist_para = createTableArg(ConstantDataArray::get(llvm_context, hist_table), F, ".te_hist");
+				Value *args[] = {load, detect_result_sub_inst, ctx_para, hist_para, ConstantInt::get(I64Ty, hash_bits),
+							ConstantInt::get(I64Ty, histogram_limit), siteId(BB)};
+				IRB1.CreateCall(instru_detect_histogram_f, args);
+
+				gv = M.getGlobalVariable(StringRef("current_time"), true);
+				load = IRB1.CreateLoad(gv);
+				gv = M.getGlobalVariable(StringRef("previous_time"), true);
+				IRB1.CreateStore(load, gv);
 			}
-			else if(count % 4 == 3)
+
+			llvm::StringMap<int>::iterator tit = type1_map.find(key);
+			if(tit != type1_map.end())
 			{
-				//type2 and bb global num
-				ti->type2 = atoi(line);
-				ti->bb_num = (count - 3) / 4;
-				bb_num_s_list.push_back(*ti);
-				char temp[300];
-				strcpy(temp, ti->function_name);
-				strcat(temp, ti->bb_name);
-				//errs() << temp << "\n";
-				std::string tempstr(temp);
-				//errs() << tempstr << "\n";
-				bbmap[tempstr] = ti;
-				//errs() << "ti->function_name: " << ti->function_name << "length:" << strlen(ti->function_name) << "\n";
-				//if(strlen(ti->function_name) > longest_f) longest_f = strlen(ti->function_name);
-				//if(strlen(ti->bb_name) > longest_bb) longest_bb = strlen(ti->bb_name);
+				Constant *bb_num_value = ConstantInt::get(I64Ty, tit->getValue(), true);
+				gv = M.getGlobalVariable(StringRef("pre_bb_num"), true);
+				IRBuilder<> IRB(BB->getTerminator());
+				IRB.CreateStore(bb_num_value, gv);
 			}
-
-			
-			count++;
 		}
-		fclose(gbfile);
+
+		//handle ecall exit
+		if((strcmp(F->getName().str().c_str(), p_entry_function) == 0) && (M.getFunction(p_reference_function) != NULL))
+			instrumentEcallExit(F, instru_dump_detection_result_f, initial_value_int_zero);
 	}
-	else
-	{
-		errs() << "Timed Execution Configration Error: We should have a global basic block file.\n";
-		exit(-1);
+
+	instrumentStaticSites(M, static_map);
+	instrumentTimeReset(M, reset_map);
 	}
 
-	/*errs() << "longest function name: " << longest_f << "\n";
-	errs() << "longest bb name: " << longest_bb << "\n";
 
-	if(M.getFunction("CRYPTO_num_locks") != NULL)
+	//----------------------Mode 15 for detection logic instrumentation with quantile thresholds---------------------------//
+
+	/**
+		copied from mode 12, thresholds come from a t-digest per (site, context) instead of average and stdev
+		b: quantile 1 - q of the observed deltas, c: quantile q, q is line 9 of tconfig.txt (e.g. 0.999)
+		no page fault allowance is added to c, the quantile itself bounds the false alarm rate
+		line 13 of tconfig.txt set to 1 times every check, see mode 26
+		./tdigestdata.txt : the sketches, generated from the trace on first use, concatenate the files
+				of several training runs to merge them
+	*/
+
+	if(mode == 15)
 	{
-	FILE *ttfile;
-	char tgtemp[120];
-	strcpy(tgtemp, currentd);
-	strcat(tgtemp, "/my3.txt");
-	ttfile = fopen(tgtemp, "a");
-	fprintf(ttfile, "%d\n%d\n", longest_f, longest_bb);
-	fclose(ttfile);
-	}*/
-
-	/*struct bb_num_s* mapt = bbmap["EVP_CIPHER_CTX_freeEVP_CIPHER_CTX_cleanup.exit"];
-	if(mapt == NULL) errs() << "mapt == NULL\n";
-	else errs() << "the data found in maps is: " << "function name: " << mapt->function_name << "bb name: " 
-		<< mapt->bb_name << "bb num: " << mapt->bb_num << "type1 flag: " << mapt->type1 
-		<< "type2 flag: " << mapt->type2 << "\n";*/
-
-	/*if(M.getFunction("ecall_DoNumSort") != NULL)
-	{
-	for(std::vector<struct bb_num_s>::iterator it = bb_num_s_list.begin() ; it != bb_num_s_list.end(); ++it)
-	{
-		FILE *file;
-		char tgtemp[120];
-		strcpy(tgtemp, currentd);
-		strcat(tgtemp, "/my.txt");
-		file = fopen(tgtemp, "a");
-		//printf("%s\n",str);
-		//fprintf(file, "%s\n%s\n%lu\n", function_name, bb_name, t);
-		fprintf(file, "%s\n%s\n%d\n%d\n%d\n", it->function_name, it->bb_name, it->bb_num, it->type1, it->type2);
-		fclose(file);
-	}
-	}
-	bb_num_s_list.clear();*/
-
-
+	errs() << "quantile -----> " << quantile << "\n";
 
+	llvm::StringMap<struct site_model> site_map;
+	llvm::StringMap<int> type1_map;
+	loadTraceList(currentd);
+	buildSiteModels(site_map, type1_map);
+	llvm::StringMap<double> static_map;
+	estimateStaticSites(M, currentd, site_map, static_map);
+	buildSiteDigests(currentd, site_map);
+	trace_list.clear();
+	llvm::StringMap<int> reset_map;
+	pruneSiteModels(currentd, site_map, reset_map);
 
-	//-------------------processing tdata.txt ttdata.txt-----------------//
-
-	FILE *datafile, *tracefile;
-	char tgtemp1[300];
-	strcpy(tgtemp1, currentd);
-	strcat(tgtemp1, "/tdata.txt");
-	char tgtemp2[300];
-	strcpy(tgtemp2, currentd);
-	strcat(tgtemp2, "/ttdata.txt");
-	datafile = fopen(tgtemp1,"r");
-	tracefile = fopen(tgtemp2,"r");
-	if(datafile)
+	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
 	{
-		if(tracefile)
+		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
+		for(Function::iterator FI = MI->begin(), FE = MI->end(); FI != FE; FI++)
 		{
-			char *line1 = NULL;
-			size_t len1 = 0;
-			ssize_t read1;
-			int count1 = 0;
-			char *line2 = NULL;
-			size_t len2 = 0;
-			ssize_t read2;
-			int count2 = 0;
-			char *line3= NULL;
-			size_t len3 = 0;
-			ssize_t read3;
+			BasicBlock *BB = FI;
+			std::string key = F->getName().str() + blockName(BB);
 
-			while (((read1 = getline(&line1, &len1, datafile)) != -1) 
-				&& ((read2 = getline(&line2, &len2, tracefile)) != -1)
-				&& ((read3 = getline(&line3, &len3, tracefile)) != -1))
+			//instrument type2 first
+			llvm::StringMap<struct site_model>::iterator sit = site_map.find(key);
+			if(sit != site_map.end())
 			{
-				//leave out last character '\n'
-				line1[read1-1] = '\0';
-				line2[read2-1] = '\0';
-				line3[read3-1] = '\0';
-				struct training_info *ti = (struct training_info*) malloc (sizeof(struct training_info));
-				ti->bb_time = atoi(line1);
-				ti->function_name = (char *) malloc(300);
-				ti->bb_name = (char *) malloc(300);
-				strcpy(ti->function_name, line2);
-				strcpy(ti->bb_name, line3);
-				char temp[300];
-				strcpy(temp, ti->function_name);
-				strcat(temp, ti->bb_name);
-				struct bb_num_s* mapt = bbmap[temp];
-				//if(mapt == NULL) errs() << "mapt == NULL\n";
-				//else errs() << "the data found in maps is: " << "function name: " << mapt->function_name 
-					//<< "bb name: " << mapt->bb_name << "bb num: " << mapt->bb_num << "type1 flag: " 
-					//<< mapt->type1 << "type2 flag: " << mapt->type2 << "\n";
-				if(mapt == NULL)
-				{
-					errs() << "--------------- mapt == NULL ----------------\n";
-					FILE *file;
-					char tgtemp[120];
-					strcpy(tgtemp, currentd);
-					strcat(tgtemp, "/my2.txt");
-					file = fopen(tgtemp, "a");
-					fprintf(file, "%s\n%s\n", ti->function_name, ti->bb_name);
-					fclose(file);
-					ti->bb_num = -1;
-					ti->type1 = -1;
-					ti->type2 = -1;
-				}
-				else
+				struct site_model &sm = sit->getValue();
+				std::vector<double> b_vector3, c_vector3;
+				for(std::vector<struct context_model>::iterator cit = sm.contexts.begin(); cit != sm.contexts.end(); cit++)
 				{
-					ti->bb_num = mapt->bb_num;
-					ti->type1 = mapt->type1;
-					ti->type2 = mapt->type2;
+					b_vector3.push_back(cit->digest.quantile(1 - quantile));
+					c_vector3.push_back(cit->digest.quantile(quantile));
+					errs() << "prior bb num: " << cit->bb_num << " b: " << b_vector3.back() << " c: " << c_vector3.back() << "\n";
 				}
-				info_list.push_back(*ti);
+
+				IRBuilder<> IRB1(BB->getTerminator());
+				Value *check_begin = beginCheckTiming(IRB1);
+				emitDetectCall(IRB1, BB, sm, b_vector3, c_vector3);
+				endCheckTiming(IRB1, check_begin);
+			}
+
+			llvm::StringMap<int>::iterator tit = type1_map.find(key);
+			if(tit != type1_map.end())
+			{
+				Constant *bb_num_value = ConstantInt::get(I64Ty, tit->getValue(), true);
+				gv = M.getGlobalVariable(StringRef("pre_bb_num"), true);
+				IRBuilder<> IRB(BB->getTerminator());
+				IRB.CreateStore(bb_num_value, gv);
 			}
-			fclose(datafile);
-			fclose(tracefile);
 		}
-		else
+
+		//handle ecall exit
+		if((strcmp(F->getName().str().c_str(), p_entry_function) == 0) && (M.getFunction(p_reference_function) != NULL))
 		{
-			errs() << "Timed Execution Configration Error: We should have a trace file.\n";
-			exit(-1);
+			instrumentEcallExit(F, instru_dump_detection_result_f, initial_value_int_zero);
+			if(measure_checks)
+				instrumentEcallExit(F, instru_dump_check_cycles_f, initial_value_int_zero);
 		}
 	}
-	else
-	{
-		errs() << "Timed Execution Configration Error: We should have a data file.\n";
-		exit(-1);
+
+	instrumentStaticSites(M, static_map);
+	instrumentTimeReset(M, reset_map);
 	}
-	bbmap.clear();
-	bb_num_s_list.clear();
 
 
-	/*if(M.getFunction("ecall_DoNumSort") != NULL)
+
+	//----------------------Mode 16 for page fault penalty training---------------------------//
+	/**
+		copied from Mode 0
+		needs compile and run
+		only a sampled subset of the intervals is faulted, every sample_period-th (line 17 of tconfig.txt), at random
+		countdowns of that average with sample_random (line 18), 1 faults every interval
+		every type2 site ends with instrument_function_fault_next, which arms te_fault_armed for the next interval
+		when its countdown runs out and then spins page_fault_average ticks, the exit itself
+		every load and store is preceded by instrument_function_inject_fault, which flushes its address while armed,
+		the cold caches an exit leaves behind, linkRuntime inlines it to a load and a branch
+		only faulted intervals are recorded, the others are recorded as -1 and skipped by loadTraceList, so every
+		sample of the faulted run still looks like one hit by a page fault
+		generate: ./tfootprintdata.txt, ./tdata.txt, ./ttdata.txt
+		./tfootprintdata.txt : each entry: function name, basic block name, footprint class of the type2 block
+				generated when compiling
+		./tdata.txt, ./ttdata.txt : same as mode 0, rename them to ./tfdata.txt, ./ttfdata.txt for mode 17
+				generated when running
+	*/
+
+	if(mode == 16)
 	{
-	for(std::vector<struct training_info>::iterator trit = info_list.begin() ; trit != info_list.end(); ++trit)
+	Value *instru_inject_fault_f = M.getOrInsertFunction("instrument_function_inject_fault", VoidTy, I8PtrTy, nullptr);
+	Value *instru_fault_next_f = M.getOrInsertFunction("instrument_function_fault_next", VoidTy, I64Ty, I64Ty, I64Ty, nullptr);
+	errs() << "fault sample period -----> " << sample_period << (sample_random ? " random" : "") << "\n";
+	//already there when linkRuntime brought the runtime in
+	gv = M.getGlobalVariable(StringRef("te_fault_armed"), true);
+	if(gv == NULL)
 	{
-		FILE *file;
-		char tgtemp[120];
-		strcpy(tgtemp, currentd);
-		strcat(tgtemp, "/my1.txt");
-		file = fopen(tgtemp, "a");
-		//printf("%s\n",str);
-		//fprintf(file, "%s\n%s\n%lu\n", function_name, bb_name, t);
-		fprintf(file, "%s\n%s\n%d\n%d\n%d\n%d\n", trit->function_name, trit->bb_name, trit->bb_time, trit->bb_num, trit->type1, trit->type2);
-		fclose(file);
-
+		gv = new GlobalVariable(M, I64Ty, false, GlobalValue::AvailableExternallyLinkage, 0, "te_fault_armed");
+		gv->setInitializer(initial_value_int_one);
 	}
-	}*/
-	//info_list.clear();
+	Value *fault_args[] = {ConstantInt::get(I64Ty, std::max(sample_period, 1L)), ConstantInt::get(I64Ty, sample_random), page_fault_average_value_int};
 
+	FILE *ffile;
+	char tftemp[300];
+	strcpy(tftemp, currentd);
+	strcat(tftemp, "/tfootprintdata.txt");
+	ffile = fopen(tftemp, "a");
 
+	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
+	{
+		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
+		for(Function::iterator FI = MI->begin(), FE = MI->end(); FI != FE; FI++)
+		{
+			BasicBlock *BB = FI;
+			int type2 = isType2Block(BB);
+			int footprint_class = footprintClass(BB);
 
+			//inject before the original memory accesses only
+			std::vector<Instruction *> mem_vector;
+			for(BasicBlock::iterator BI = BB->begin(), BE = BB->end(); BI != BE; BI++)
+			{
+				Instruction *II = BI;
+				if(isa<LoadInst>(II) || isa<StoreInst>(II)) mem_vector.push_back(II);
+			}
+			for(std::vector<Instruction *>::iterator it = mem_vector.begin(); it != mem_vector.end(); it++)
+			{
+				Value *ptr = isa<LoadInst>(*it) ? cast<LoadInst>(*it)->getPointerOperand() : cast<StoreInst>(*it)->getPointerOperand();
+				IRBuilder<> IRBm(*it);
+				IRBm.CreateCall(instru_inject_fault_f, IRBm.CreatePointerCast(ptr, I8PtrTy));
+			}
 
-	/*obsolete
-	//mark trace nodes type1 and type2
-	//mark bb_num
-	for(std::vector<struct bb_num_s>::iterator it = bb_num_s_list.begin() ; it != bb_num_s_list.end(); ++it)
-	{
-		markBBNumType1Type2Info(it->function_name, it->bb_name, it->bb_num, it->type1, it->type2);
-	}
+			//get insert point: the end of the basic block
+			IRBuilder<> IRB(BB->getTerminator());
+			Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
+			Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
 
-	if(M.getFunction("CRYPTO_num_locks") != NULL)
-	{
-	printMark(M);
-	}*/
+			//type 2 nodes
+			if(type2)
+			{
+				fprintf(ffile, "%s\n%s\n%d\n", F->getName().str().c_str(), blockName(BB).c_str(), footprint_class);
 
+				//get time before our time consuming process
+				gv = M.getGlobalVariable(StringRef("current_time"), true);
+				load = IRB.CreateLoad(gv);
+				gv = M.getGlobalVariable(StringRef("previous_time"), true);
+				LoadInst *last_time_load = IRB.CreateLoad(gv);
+				IRB.CreateStore(load, gv);
 
-	//process trace
-	//collect trace info from trainging info
-	//backwards in training info list
-	int need_type1_bb_num = 0;
-	struct trace_info *ti;
-	for(std::vector<struct training_info>::iterator it = info_list.end() - 1; it >= info_list.begin(); it--)
-	{
-		if(need_type1_bb_num)
-		{
-			ti->context_type1_function_name = (char *) malloc(60);
-			strcpy(ti->context_type1_function_name, it->function_name);
-			ti->context_type1_bb_name = (char *) malloc(60);
-			strcpy(ti->context_type1_bb_name, it->bb_name);
-			ti->context_type1_bb_num = it->bb_num;
-			trace_list.push_back(*ti);
-			need_type1_bb_num = 0;
-		}
-		if(it->type2 == 1)// && it != info_list.begin())
-		{
-			ti = (struct trace_info*) malloc (sizeof(struct trace_info));
-			ti->function_name = (char *) malloc(60);
-			strcpy(ti->function_name, it->function_name);
-			ti->tail_type2_bb_name = (char *) malloc(60);
-			strcpy(ti->tail_type2_bb_name, it->bb_name);
-			ti->bb_time = it->bb_time;
-			need_type1_bb_num = 1;
-			//special handling for the entry of the ecall
-			if(it == info_list.begin())
+				Value *sub = IRB.CreateSub(load, last_time_load);
+				//intervals without faults are not samples of the faulted run
+				Value *armed = IRB.CreateICmpNE(IRB.CreateLoad(M.getGlobalVariable(StringRef("te_fault_armed"), true)), initial_value_int_zero);
+				Value *args[] = {str_para1, str_para2, IRB.CreateSelect(armed, sub, initial_value_int_minus_one)};
+				//insert record
+				IRB.CreateCall(instru_insert_record_f, args);
+
+				//get time again after our time consuming process
+				gv = M.getGlobalVariable(StringRef("current_time"), true);
+				load = IRB.CreateLoad(gv);
+				gv = M.getGlobalVariable(StringRef("previous_time"), true);
+				IRB.CreateStore(load, gv);
+
+				//the next interval may start with an emulated exit
+				IRB.CreateCall(instru_fault_next_f, fault_args);
+			}
+			else
 			{
-				ti->context_type1_function_name = (char *) malloc(60);
-				strcpy(ti->context_type1_function_name, " ");
-				ti->context_type1_bb_name = (char *) malloc(60);
-				strcpy(ti->context_type1_bb_name, " ");
-				ti->context_type1_bb_num = -1;
-				trace_list.push_back(*ti);
+				//insert a -1 value
+				Value *args[] = {str_para1, str_para2, initial_value_int_minus_one};
+				IRB.CreateCall(instru_insert_record_f, args);
 			}
 		}
-	}
 
-	//print for debugging
-	/*if(M.getFunction("ecall_DoNumSort") != NULL)
-	{
-	for(std::vector<struct trace_info>::iterator it = trace_list.begin() ; it != trace_list.end(); it++)
-	{
-		FILE *file;
-		char tgtemp[120];
-		strcpy(tgtemp, currentd);
-		strcat(tgtemp, "/my4.txt");
-		file = fopen(tgtemp, "a");
-		//fprintf(file, "%s\n%s\n%d\n%d\n%d\n%d\n", it->function_name, it->bb_name, it->bb_num, it->bb_time, it->type1, it->type2);
-		
-		//if(strcmp(M.getModuleIdentifier().c_str(), MAINFILE) == 0)
-			fprintf(file, "%s\n%s\n%s\n%s\n%d\n%lu\n", 
-				it->function_name, it->tail_type2_bb_name, it->context_type1_function_name, it->context_type1_bb_name, it->context_type1_bb_num, it->bb_time);
-		
-		fclose(file);
-	}
+		//dump all timing infomation at the end of ecall
+		if((strcmp(F->getName().str().c_str(), p_entry_function) == 0) && (M.getFunction(p_reference_function) != NULL))
+		{
+			instrumentEcallExit(F, instru_dump_result_f, initial_value_int_zero);
+			instrumentEcallExit(F, instru_set_loop_false_f, initial_value_int_zero);
+		}
 	}
 
-	//print for debugging
-	int t2_count = 0;
-	for(std::vector<struct training_info>::iterator it = info_list.end() - 1; it >= info_list.begin(); it--)
-	{
-		if(it->type2 == 1) t2_count++;
-		//printf("%d\n", t2_count);
+	fclose(ffile);
 	}
-	printf("t2_count: %d\n", t2_count);*/
 
-	info_list.clear();
 
-	//save to file
-	for(std::vector<struct trace_info>::iterator it = trace_list.begin() ; it != trace_list.end(); it++)
-	{
-		//errs() << "save to file\n";
-		FILE *file;
-		char tgtemp[120];
-		strcpy(tgtemp, currentd);
-		strcat(tgtemp, "/ttracedata.txt");
-		file = fopen(tgtemp, "a");
-			fprintf(file, "%s\n%s\n%s\n%s\n%d\n%lu\n", 
-				it->function_name, it->tail_type2_bb_name, it->context_type1_function_name, it->context_type1_bb_name, it->context_type1_bb_num, it->bb_time);
-		fclose(file);
-	}
-	}
-	//file exists
-	else
+	//----------------------Mode 17 for detection logic instrumentation with learned page fault penalty---------------------------//
+
+	/**
+		copied from mode 15, c = average + penalty average - stdev - penalty stdev, where the penalty is learned
+		per (site, context) instead of the global page_fault_average / page_fault_stdev
+		penalty average: faulted average - clean average, penalty stdev: sqrt(faulted variance - clean variance)
+		clean run: ./tdata.txt, ./ttdata.txt from mode 0, faulted run: ./tfdata.txt, ./ttfdata.txt from mode 16
+		contexts missing from the faulted run take the average penalty of the footprint class of their site
+		(./tfootprintdata.txt), and the global numbers if the class has never been measured
+	*/
+
+	if(mode == 17)
 	{
-	//errs() << "ttracedata.txt exists.\n";
-	FILE *gbfile;
-	char tgtemp3[300];
-	strcpy(tgtemp3, currentd);
-	strcat(tgtemp3, "/ttracedata.txt");
-	gbfile = fopen(tgtemp3, "r");
-	if(gbfile)
+	llvm::StringMap<struct site_model> site_map, fault_map;
+	llvm::StringMap<int> type1_map, fault_type1_map, footprint_map;
+	loadTraceList(currentd);
+	buildSiteModels(site_map, type1_map);
+	llvm::StringMap<double> static_map;
+	estimateStaticSites(M, currentd, site_map, static_map);
+	trace_list.clear();
+	llvm::StringMap<int> reset_map;
+	pruneSiteModels(currentd, site_map, reset_map);
+	loadTraceList(currentd, "/tfdata.txt", "/ttfdata.txt", "/ttracefdata.txt");
+	buildSiteModels(fault_map, fault_type1_map);
+	trace_list.clear();
+
+	//get footprint class of every type2 block
+	FILE *ffile;
+	char tftemp[300];
+	strcpy(tftemp, currentd);
+	strcat(tftemp, "/tfootprintdata.txt");
+	ffile = fopen(tftemp, "r");
+	if(ffile)
 	{
 		char *line = NULL;
 		size_t len = 0;
 		ssize_t read;
 		int count = 0;
-		struct trace_info *ti;
-		while((read = getline(&line, &len, gbfile)) != -1)
+		std::string footprint_key;
+		while((read = getline(&line, &len, ffile)) != -1)
 		{
 			//leave out last character '\n'
 			line[read-1] = '\0';
-			//errs() << "line: " << line << "\n";
-			if(count % 6 == 0)
-			{
-				//function name
-				ti = (struct trace_info*) malloc (sizeof(struct trace_info));
-				ti->function_name = (char *) malloc(300);
-				strcpy(ti->function_name, line);
-			}
-			else if(count % 6 == 1)
-			{
-				//type2 bb name
-				ti->tail_type2_bb_name = (char *) malloc(300);
-				strcpy(ti->tail_type2_bb_name, line);			
-			}
-			else if(count % 6 == 2)
-			{
-				//context type1 function name
-				ti->context_type1_function_name = (char *) malloc(300);
-				strcpy(ti->context_type1_function_name, line);			
-			}
-			else if(count % 6 == 3)
-			{
-				//context type1 bb name
-				ti->context_type1_bb_name = (char *) malloc(300);
-				strcpy(ti->context_type1_bb_name, line);			
-			}
-			else if(count % 6 == 4)
-			{
-				//context type1 bb num
-				ti->context_type1_bb_num = atoi(line);
-			}
-			else if(count % 6 == 5)
-			{
-				//type2 and bb global num
-				ti->bb_time = atoi(line);
-
-				//errs() << "ti->context_type1_function_name: " << ti->context_type1_function_name << "\n";
-				//errs() << "ti->context_type1_bb_name: " << ti->context_type1_bb_name << "\n";
-
-				trace_list.push_back(*ti);
-			}
+			if(count % 3 == 0) footprint_key = line;
+			else if(count % 3 == 1) footprint_key += line;
+			else footprint_map[footprint_key] = atoi(line);
 			count++;
 		}
-		fclose(gbfile);
+		free(line);
+		fclose(ffile);
 	}
 	else
 	{
-		errs() << "Timed Execution Configration Error: We should have a processed trace file.\n";
-		exit(-1);
+		errs() << "Timed Execution Configration Warning: no footprint file, unmeasured contexts use the global page fault numbers.\n";
 	}
 
+	//average penalty per footprint class over every context measured in both runs
+	double class_average[TE_FOOTPRINT_CLASSES] = {0}, class_stdev[TE_FOOTPRINT_CLASSES] = {0};
+	int class_count[TE_FOOTPRINT_CLASSES] = {0};
+	for(llvm::StringMap<struct site_model>::iterator sit = site_map.begin(); sit != site_map.end(); sit++)
+	{
+		llvm::StringMap<int>::iterator fit = footprint_map.find(sit->getKey());
+		if(fit == footprint_map.end()) continue;
+		for(std::vector<struct context_model>::iterator cit = sit->getValue().contexts.begin(); cit != sit->getValue().contexts.end(); cit++)
+		{
+			struct context_model *fault = findContext(fault_map, sit->getKey(), cit->bb_num);
+			if(fault == NULL) continue;
+			class_average[fit->getValue()] += fault->average - cit->average;
+			class_stdev[fit->getValue()] += sqrt(std::max(0.0, fault->stdev * fault->stdev - cit->stdev * cit->stdev));
+			class_count[fit->getValue()]++;
+		}
+	}
+	for(int i = 0; i < TE_FOOTPRINT_CLASSES; i++)
+	{
+		if(class_count[i] == 0) continue;
+		class_average[i] /= class_count[i];
+		class_stdev[i] /= class_count[i];
+		errs() << "footprint class " << i << ": " << class_count[i] << " contexts, penalty average: " << class_average[i]
+			<< " penalty stdev: " << class_stdev[i] << "\n";
 	}
 
-
-	//instrument type1 nodes
-	//type1 nodes put its bb_num to global variable pre_bb_num
-	//find every bb in this module first and then traverse trace_list
-
-	int f_count=0;
 	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
 	{
 		Function *F = MI;
-		char* function_name = (char*)malloc(60);
-		strcpy(function_name, F->getName().str().c_str());
-		int bb_count =0;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
 		for(Function::iterator FI = MI->begin(), FE = MI->end(); FI != FE; FI++)
-		{	
+		{
 			BasicBlock *BB = FI;
-			char* bb_name = (char*)malloc(180);
-			strcpy(bb_name, BB->getName().str().c_str());
-			IRBuilder<> IRB(BB->getTerminator());
-			//errs() << function_name << " " << bb_name << "\n";
-			int type1 = -1, type2 = -1;
-			std::vector<int> bb_num_vector;
-			std::vector<unsigned long> time_vector;
-			std::vector<int> bb_num_vector1;
-			std::vector<int> visited_vector1;
-			std::vector<int> bb_num_vector2;
-			std::vector<double> average_vector2;
-			std::vector<double> stdev_vector2;
-			std::vector<double> b_vector3;
-			std::vector<double> c_vector3;
-			int context_type1_bb_num = -1;
-
-			//obsolete
-			//handle the ecall entry and exit
-			/*if((strcmp(function_name, p_entry_function) == 0) && (strcmp(bb_name, "entry") == 0))
-			{
-				//gv = M.getGlobalVariable(StringRef("current_time"), true);
-				//load = IRB.CreateLoad(gv);
-				//gv = M.getGlobalVariable(StringRef("previous_time"), true);
-				//LoadInst *last_time_load = IRB.CreateLoad(gv);
-				//IRB.CreateStore(initial_value_int_zero, gv);
-
-
-				//IRBuilder<> IRB1(BB->getFirstInsertionPt());
-				//gv = M.getGlobalVariable(StringRef("current_time"), true);
-				//load = IRB1.CreateLoad(gv);
-				//IRB1.CreateCall(instru_print_long_long_int_to_debug_f, load);
-
-
-				//print for debugging
-				//IRB.CreateCall(instru_print_int_to_debug_f, last_time_load);
-				//IRB.CreateCall(instru_print_int_to_debug_f, load);
-
-				//init timer thread at the beginning of ecall
-				//clear earlier ecall records at the beginning of ecall
-				IRBuilder<> IRB1(F->front().getFirstInsertionPt());
-				IRB1.CreateCall(instru_init_f, initial_value_int_zero);
-				//IRB1.CreateCall(instru_clear_record_f, initial_value_int_zero);
-
-
-			}*/
+			std::string key = F->getName().str() + blockName(BB);
 
-			//errs() << "trace_list.size(): " << trace_list.size() << "\n";
-			for(std::vector<struct trace_info>::iterator it = trace_list.begin() ; it != trace_list.end(); it++)
-			{
-				//errs() << "it->context_type1_function_name: " << it->context_type1_function_name << "\n";
-				//errs() << "it->context_type1_bb_name: " << it->context_type1_bb_name << "\n";
-				//check if this one is type1
-				if((strcmp(it->context_type1_function_name, function_name) == 0) && (strcmp(it->context_type1_bb_name, bb_name) == 0))
-				{
-					type1 = 1;
-					context_type1_bb_num = it->context_type1_bb_num;
-				}
-				//check if any type2 nodes is this one
-				if((strcmp(it->function_name, function_name) == 0) && (strcmp(it->tail_type2_bb_name, bb_name) == 0))
-				{
-					type2 = 1;
-					//errs() << "type2: " << function_name << " " << bb_name << "\n";
-					bb_num_vector.push_back(it->context_type1_bb_num);
-					time_vector.push_back(it->bb_time);
-				}
-			}
 			//instrument type2 first
-			if(type2 == 1)
+			llvm::StringMap<struct site_model>::iterator sit = site_map.find(key);
+			if(sit != site_map.end())
 			{
-
-				//errs() << function_name << " " << bb_name << "\n";
-				errs() << "type2!\n";
-				//errs() << "size of vector: " << bb_num_vector.size();
-				//for(std::vector<int>::iterator it = bb_num_vector.begin() ; it != bb_num_vector.end(); it++)
-					//for(std::vector<unsigned long>::iterator itt = time_vector.begin() ; itt != time_vector.end(); itt++)
-						//errs() << *it << " " << *itt << ", ";
-				//errs() << "\n";
-				//get average and stdev
-				//copy bb_num_vector to bb_num_vector1, bb_num_vector1 works as a temp vector with UNIQUE values
-				for(std::vector<int>::iterator it = bb_num_vector.begin() ; it != bb_num_vector.end(); it++)
-				{
-					int in_it = 0;
-					for(std::vector<int>::iterator itt = bb_num_vector1.begin() ; itt != bb_num_vector1.end(); itt++)
-						if(*it == *itt) in_it = 1;
-					if(in_it == 0)bb_num_vector1.push_back(*it);
-				}
-				errs() << "size of vector: " << bb_num_vector1.size() << "\n";
-				//initialize visited_vector1 as all 0;
-				for(std::vector<int>::iterator it = bb_num_vector.begin() ; it != bb_num_vector.end(); it++)
-					visited_vector1.push_back(0);
-				//check each value in bb_num_vector1
-				for(std::vector<int>::iterator it = bb_num_vector1.begin() ; it != bb_num_vector1.end(); it++)
+				struct site_model &sm = sit->getValue();
+				llvm::StringMap<int>::iterator fit = footprint_map.find(key);
+				std::vector<double> b_vector3, c_vector3;
+				for(std::vector<struct context_model>::iterator cit = sm.contexts.begin(); cit != sm.contexts.end(); cit++)
 				{
-					int count = 0;
-					double average = -1.0;
-					double stdev = -1.0;
-					std::vector<unsigned long> specific_vector;
-					//process everyone in bb_num_vector that has such value
-					std::vector<int>::iterator itt = bb_num_vector.begin();
-					std::vector<int>::iterator ittt = visited_vector1.begin();
-					std::vector<unsigned long>::iterator itttt = time_vector.begin();
-					while(itt != bb_num_vector.end() && ittt != visited_vector1.end() && itttt != time_vector.end())
+					double penalty_average = page_fault_average, penalty_stdev = page_fault_stdev;
+					const char *penalty_source = "global";
+					struct context_model *fault = findContext(fault_map, key, cit->bb_num);
+					if(fault != NULL)
 					{
-						//if it is visited before, do not bother that
-						if(*itt == *it && *ittt == 0)
-						{
-							//mark as visited
-							*ittt = 1;
-							count++;
-							specific_vector.push_back(*itttt);
-						}
-						itt++;ittt++;itttt++;
+						penalty_average = std::max(0.0, fault->average - cit->average);
+						penalty_stdev = sqrt(std::max(0.0, fault->stdev * fault->stdev - cit->stdev * cit->stdev));
+						penalty_source = "site";
 					}
-					//calculate average
-					average = 0;
-					for(std::vector<unsigned long>::iterator myit = specific_vector.begin() ; myit != specific_vector.end(); myit++)
-						average += *myit;
-					average /= count;
-					//calculate stdev
-					stdev = 0;
-					//errs() << "data:\n";
-					for(std::vector<unsigned long>::iterator myit = specific_vector.begin() ; myit != specific_vector.end(); myit++)
+					else if(fit != footprint_map.end() && class_count[fit->getValue()] > 0)
 					{
-						//errs() << *myit << " ";
-						stdev = stdev + (*myit - average) * (*myit - average);
+						penalty_average = std::max(0.0, class_average[fit->getValue()]);
+						penalty_stdev = class_stdev[fit->getValue()];
+						penalty_source = "class";
 					}
-					//errs() << "\ncount: " << count << "\n";
-					stdev /= count;
-					stdev = sqrt(stdev);
-					//errs() << "stdev: " << stdev << "\n";
-					bb_num_vector2.push_back(*it);
-					average_vector2.push_back(average);
-					stdev_vector2.push_back(stdev);
+					b_vector3.push_back(lowerBound(cit->average, cit->stdev));
+					c_vector3.push_back(cit->average + penalty_average - cit->stdev - penalty_stdev);
+					errs() << "prior bb num: " << cit->bb_num << " average: " << cit->average << " stdev: " << cit->stdev
+						<< " penalty (" << penalty_source << "): " << penalty_average << " " << penalty_stdev << " c: " << c_vector3.back() << "\n";
 				}
-				std::vector<int>::iterator myit = bb_num_vector2.begin();
-				std::vector<double>::iterator myit1 = average_vector2.begin();
-				std::vector<double>::iterator myit2 = stdev_vector2.begin();
 
-				//print for debugging
-				while(myit != bb_num_vector2.end() && myit1 != average_vector2.end() && myit2 != stdev_vector2.end())
-				{
-					errs() << "prior bb num: " << *myit << " average: " << *myit1 << " stdev: " << *myit2 << "\n";
-					myit++; myit1++; myit2++;
-				}
+				IRBuilder<> IRB1(BB->getTerminator());
+				emitDetectCall(IRB1, BB, sm, b_vector3, c_vector3);
+			}
 
+			llvm::StringMap<int>::iterator tit = type1_map.find(key);
+			if(tit != type1_map.end())
+			{
+				Constant *bb_num_value = ConstantInt::get(I64Ty, tit->getValue(), true);
+				gv = M.getGlobalVariable(StringRef("pre_bb_num"), true);
+				IRBuilder<> IRB(BB->getTerminator());
+				IRB.CreateStore(bb_num_value, gv);
+			}
+		}
 
-				errs() << "**************************************************type2!\n";
+		//handle ecall exit
+		if((strcmp(F->getName().str().c_str(), p_entry_function) == 0) && (M.getFunction(p_reference_function) != NULL))
+			instrumentEcallExit(F, instru_dump_detection_result_f, initial_value_int_zero);
+	}
 
+	instrumentStaticSites(M, static_map);
+	instrumentTimeReset(M, reset_map);
+	}
 
 
-				//transform structure
-				/*//Value *mine_f = M.getOrInsertFunction("mine", VoidTy, I64Ty, nullptr);
-				gv = M.getGlobalVariable(StringRef("current_time"), true);
-				load = IRB.CreateLoad(gv);
-				gv = M.getGlobalVariable(StringRef("previous_time"), true);
-				LoadInst *lload = IRB.CreateLoad(gv);
 
-				TerminatorInst *I1 = BB->getTerminator();
-				Instruction *nop = BinaryOperator::Create(Instruction::Add, initial_value_int_zero, initial_value_int_zero);
-				BB->getInstList().insert(I1, nop);
-				BasicBlock *newBB1 = BB->splitBasicBlock(nop, "newbasicblock2");
+	//----------------------Mode 18 for per site tfactor calibration---------------------------//
+	/**
+		offline, no instrumentation, compile once with it after mode 0 training and before mode 9
+		the trace is split into ecall runs, every TE_HOLDOUT_RUNS-th run is held out, c is built from the
+		other runs exactly like mode 9 and every held-out delta d of a site asks for the factor d / c
+		the factor of a site is the 1 - target_fpr quantile of those, at least 1, target_fpr is line 10 of tconfig.txt
+		sites without held-out deltas keep the global tfactor
+		mode 9 multiplies the factor into this same c, from the same split and at least 1, see splitHeldout
+		generate: ./tfactordata.txt : each entry: function name, basic block name, factor
+	*/
 
-				I1 = BB->getTerminator();
-				nop = BinaryOperator::Create(Instruction::Add, initial_value_int_zero, initial_value_int_zero);
-				//CallInst *callv = CallInst::Create(mine_f, initial_value_int_zero);
-				BB->getInstList().insert(I1, nop);
-				BasicBlock *newBB2 = BB->splitBasicBlock(nop, "newbasicblock3");
+	if(mode == 18)
+	{
+	errs() << "target_fpr -----> " << target_fpr << "\n";
+	loadTraceList(currentd);
+	std::vector<struct trace_info> train_list, heldout_list;
+	splitHeldout(train_list, heldout_list);
 
-				I1 = BB->getTerminator();
-				//Value * cmpv = IRB.CreateICmpUGT(lload, load);
-				BranchInst *bran1 = BranchInst::Create(newBB1, newBB2, CmpInst::Create(Instruction::ICmp, CmpInst::ICMP_EQ, lload, load, "compare", I1));
-				ReplaceInstWithInst(I1, bran1);*///
+	llvm::StringMap<struct site_model> train_map, heldout_map;
+	llvm::StringMap<int> type1_map;
+	trace_list = train_list;
+	buildSiteModels(train_map, type1_map);
+	trace_list = heldout_list;
+	buildSiteModels(heldout_map, type1_map);
+	trace_list.clear();
 
-				//add instructions
-				//add to BB, that is, kind of front
-				IRBuilder<> IRB1(BB->getTerminator());
-				gv = M.getGlobalVariable(StringRef("current_time"), true);
-				load = IRB1.CreateLoad(gv);
-				Value *curr = load;
+	char tftemp[300], tftemp1[320];
+	strcpy(tftemp, currentd);
+	strcat(tftemp, "/tfactordata.txt");
+	sprintf(tftemp1, "%s.%d", tftemp, getpid());
+	FILE *ffile = fopen(tftemp1, "w");
+	int sites = 0;
+	unsigned long heldout_total = 0, heldout_alarms = 0;
+	for(llvm::StringMap<struct site_model>::iterator sit = heldout_map.begin(); sit != heldout_map.end(); sit++)
+	{
+		struct site_model &sm = sit->getValue();
+		std::vector<double> ratio_vector;
+		for(std::vector<struct context_model>::iterator cit = sm.contexts.begin(); cit != sm.contexts.end(); cit++)
+		{
+			//contexts never trained are never checked
+			struct context_model *train = findContext(train_map, sit->getKey(), cit->bb_num);
+			if(train == NULL) continue;
+			double c = std::max(1.0, train->average + page_fault_average - train->stdev - page_fault_stdev);
+			for(std::vector<unsigned long>::iterator myit = cit->samples.begin(); myit != cit->samples.end(); myit++)
+				ratio_vector.push_back(*myit / c);
+		}
+		if(ratio_vector.empty()) continue;
+
+		std::sort(ratio_vector.begin(), ratio_vector.end());
+		size_t allowed = (size_t)(target_fpr * ratio_vector.size());
+		double factor = ratio_vector[ratio_vector.size() - 1 - allowed];
+		if(factor < 1) factor = 1;
+		size_t alarms = ratio_vector.end() - std::upper_bound(ratio_vector.begin(), ratio_vector.end(), factor);
+
+		fprintf(ffile, "%s\n%s\n%lf\n", sm.function_name.c_str(), sm.bb_name.c_str(), factor);
+		errs() << sm.function_name << " " << sm.bb_name << " factor: " << factor << " held-out: " << ratio_vector.size() << " alarms: " << alarms << "\n";
+		sites++;
+		heldout_total += ratio_vector.size();
+		heldout_alarms += alarms;
+	}
+	fclose(ffile);
+	rename(tftemp1, tftemp);
+	errs() << "calibrated sites: " << sites << ", held-out deltas: " << heldout_total << ", held-out false positive rate: "
+		<< (heldout_total ? (double)heldout_alarms / heldout_total : 0) << "\n";
+	}
+
+
+
+
+	//----------------------Mode 19 for cusum detection---------------------------//
+
+	/**
+		copied from mode 15, no call per site: every type2 site adds its score to a running cusum statistic
+		in the enclave (cusum_statistic in detect.c) and the runtime is called only when it crosses the limit
+		score: ((delta - reference) * multiplier) >> TE_CUSUM_SCALE_BITS, reference: average + TE_CUSUM_SLACK * stdev
+			of the context, multiplier: per context, one stdev of the context is 2^TE_CUSUM_FRACTION_BITS units,
+			contexts without a stdev of their own (one sample) take the stdev pooled over the kept contexts of the site
+		a switch on pre_bb_num picks the reference and the multiplier, contexts pruned or never trained go to the default
+			and score nothing
+		statistic: max(0, statistic + score), the floor by a sign mask, then one compare against the limit
+		limit: cusum_limit standard deviations, line 11 of tconfig.txt
+		the cap of a score at limit / 2, which keeps a single page fault from alarming alone, is applied on the cold
+			path by instrument_function_cusum_alarm, the statistic is reset at every ecall entry
+	*/
+
+	if(mode == 19)
+	{
+	errs() << "cusum_limit -----> " << cusum_limit << "\n";
+	long cusum_units = cusum_limit * (1 << TE_CUSUM_FRACTION_BITS);
+	Constant *cusum_limit_value = ConstantInt::get(I64Ty, cusum_units, true);
+	Value *instru_cusum_alarm_f = M.getOrInsertFunction("instrument_function_cusum_alarm", VoidTy, I64Ty, I64Ty, I64Ty, I32Ty, nullptr);
+	//already there when linkRuntime brought the runtime in
+	gv = M.getGlobalVariable(StringRef("cusum_statistic"), true);
+	if(gv == NULL)
+	{
+		gv = new GlobalVariable(M, I64Ty, false, GlobalValue::AvailableExternallyLinkage, 0, "cusum_statistic");
+		gv->setInitializer(initial_value_int_zero);
+	}
+
+	llvm::StringMap<struct site_model> site_map;
+	llvm::StringMap<int> type1_map;
+	loadTraceList(currentd);
+	buildSiteModels(site_map, type1_map);
+	llvm::StringMap<double> static_map;
+	estimateStaticSites(M, currentd, site_map, static_map);
+	trace_list.clear();
+	llvm::StringMap<int> reset_map;
+	pruneSiteModels(currentd, site_map, reset_map);
+
+	//blocks are split below, collect them first
+	std::vector<BasicBlock *> bb_vector;
+	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
+	{
+		if(MI->isDeclaration() || MI->hasAvailableExternallyLinkage()) continue;
+		for(Function::iterator FI = MI->begin(), FE = MI->end(); FI != FE; FI++)
+			bb_vector.push_back(FI);
+	}
+
+	for(std::vector<BasicBlock *>::iterator bit = bb_vector.begin(); bit != bb_vector.end(); bit++)
+	{
+		BasicBlock *BB = *bit;
+		Function *F = BB->getParent();
+		std::string key = F->getName().str() + blockName(BB);
+
+		//type1 store goes first, the check below reads pre_bb_num before it
+		Instruction *tail_begin = BB->getTerminator();
+		llvm::StringMap<int>::iterator tit = type1_map.find(key);
+		if(tit != type1_map.end())
+		{
+			Constant *bb_num_value = ConstantInt::get(I64Ty, tit->getValue(), true);
+			gv = M.getGlobalVariable(StringRef("pre_bb_num"), true);
+			IRBuilder<> IRB(BB->getTerminator());
+			tail_begin = IRB.CreateStore(bb_num_value, gv);
+		}
+
+		llvm::StringMap<struct site_model>::iterator sit = site_map.find(key);
+		if(sit == site_map.end()) continue;
+		struct site_model &sm = sit->getValue();
+		//every context pruned, nothing left to score
+		if(sm.contexts.empty()) continue;
+
+		//site wide stdev of the kept contexts, for contexts without a stdev of their own
+		double sum = 0, square_sum = 0, n = 0;
+		for(std::vector<struct context_model>::iterator cit = sm.contexts.begin(); cit != sm.contexts.end(); cit++)
+			for(std::vector<unsigned long>::iterator myit = cit->samples.begin(); myit != cit->samples.end(); myit++)
+			{
+				sum += *myit; square_sum += (double)*myit * *myit; n++;
+			}
+		double site_average = n > 0 ? sum / n : 0;
+		double site_stdev = n > 0 ? sqrt(std::max(0.0, square_sum / n - site_average * site_average)) : 0;
+
+		IRBuilder<> IRB1(tail_begin);
+		gv = M.getGlobalVariable(StringRef("current_time"), true);
+		load = IRB1.CreateLoad(gv);
+		gv = M.getGlobalVariable(StringRef("previous_time"), true);
+		LoadInst *last_time_load = IRB1.CreateLoad(gv);
+		IRB1.CreateStore(load, gv);
+		Value *delta = IRB1.CreateSub(load, last_time_load);
+		gv = M.getGlobalVariable(StringRef("pre_bb_num"), true);
+		Value *pre = IRB1.CreateLoad(gv);
+
+		//switch on the context, each case only passes its reference and multiplier on
+		BasicBlock *tail = BB->splitBasicBlock(tail_begin);
+		BasicBlock *update = BasicBlock::Create(llvm_context, "", F, tail);
+		IRBuilder<> IRB4(update);
+		PHINode *reference = IRB4.CreatePHI(I64Ty, sm.contexts.size());
+		PHINode *multiplier = IRB4.CreatePHI(I64Ty, sm.contexts.size());
+		BB->getTerminator()->eraseFromParent();
+		IRBuilder<> IRB5(BB);
+		SwitchInst *context_switch = IRB5.CreateSwitch(pre, tail, sm.contexts.size());
+		for(std::vector<struct context_model>::iterator cit = sm.contexts.begin(); cit != sm.contexts.end(); cit++)
+		{
+			double stdev = cit->stdev > 0 ? cit->stdev : site_stdev;
+			BasicBlock *pick = BasicBlock::Create(llvm_context, "", F, update);
+			BranchInst::Create(update, pick);
+			reference->addIncoming(ConstantInt::get(I64Ty, (long)(cit->average + TE_CUSUM_SLACK * stdev), true), pick);
+			multiplier->addIncoming(ConstantInt::get(I64Ty, cusumMultiplier(stdev), true), pick);
+			context_switch->addCase(cast<ConstantInt>(ConstantInt::get(I64Ty, cit->bb_num, true)), pick);
+			errs() << "prior bb num: " << cit->bb_num << " reference: " << (long)(cit->average + TE_CUSUM_SLACK * stdev)
+				<< " multiplier: " << cusumMultiplier(stdev) << "\n";
+		}
+
+		Value *score = IRB4.CreateAShr(IRB4.CreateMul(IRB4.CreateSub(delta, reference), multiplier), ConstantInt::get(I64Ty, TE_CUSUM_SCALE_BITS));
+		gv = M.getGlobalVariable(StringRef("cusum_statistic"), true);
+		Value *statistic = IRB4.CreateAdd(IRB4.CreateLoad(gv), score);
+		statistic = IRB4.CreateAnd(statistic, IRB4.CreateNot(IRB4.CreateAShr(statistic, ConstantInt::get(I64Ty, 63))));
+		IRB4.CreateStore(statistic, gv);
+
+		//alarm path, the runtime caps the score, reports and resets the statistic
+		BasicBlock *alarm = BasicBlock::Create(llvm_context, "", F, tail);
+		IRB4.CreateCondBr(IRB4.CreateICmpSGT(statistic, cusum_limit_value), alarm, tail);
+		IRBuilder<> IRB2(alarm);
+		Value *args[] = {statistic, score, cusum_limit_value, siteId(BB)};
+		IRB2.CreateCall(instru_cusum_alarm_f, args);
+		IRB2.CreateBr(tail);
+
+		//get time again after the check
+		IRBuilder<> IRB3(tail->getFirstInsertionPt());
+		gv = M.getGlobalVariable(StringRef("current_time"), true);
+		load = IRB3.CreateLoad(gv);
+		gv = M.getGlobalVariable(StringRef("previous_time"), true);
+		IRB3.CreateStore(load, gv);
+	}
+
+	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
+	{
+		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
+		if((strcmp(F->getName().str().c_str(), p_entry_function) == 0) && (M.getFunction(p_reference_function) != NULL))
+		{
+			//no evidence carries over from the previous request
+			IRBuilder<> IRB(F->front().getFirstInsertionPt());
+			IRB.CreateStore(initial_value_int_zero, M.getGlobalVariable(StringRef("cusum_statistic"), true));
+
+			//handle ecall exit
+			instrumentEcallExit(F, instru_dump_detection_result_f, initial_value_int_zero);
+		}
+	}
+
+	instrumentStaticSites(M, static_map);
+	instrumentTimeReset(M, reset_map);
+	}
+
+
+
+
+	//----------------------Mode 20 for detection with a mixture model per context---------------------------//
+
+	/**
+		copied from mode 19, a TE_MIXTURE_COMPONENTS gaussian mixture is fitted by EM to the deltas of every
+		(site, context) so warm/cold or short/long paths each get their own average and stdev
+		every component k gets the bounds b_k = lowerBound(average_k, stdev_k), c_k = average_k + page_fault_average - stdev_k - page_fault_stdev
+		a switch on pre_bb_num picks the bounds of every kept context, contexts pruned or never trained go to the default
+		and are not checked, as in mode 19
+		the check accepts delta when it is inside any component, one unsigned compare each: delta - b_k <= c_k - b_k,
+		and calls instrument_function_report_anomaly only otherwise
+		components of weight below TE_MIXTURE_MIN_WEIGHT are dropped
+	*/
+
+	if(mode == 20)
+	{
+	Value *instru_report_anomaly_f = M.getOrInsertFunction("instrument_function_report_anomaly", VoidTy, I64Ty, I64Ty, I32Ty, nullptr);
+
+	llvm::StringMap<struct site_model> site_map;
+	llvm::StringMap<int> type1_map;
+	loadTraceList(currentd);
+	buildSiteModels(site_map, type1_map);
+	llvm::StringMap<double> static_map;
+	estimateStaticSites(M, currentd, site_map, static_map);
+	trace_list.clear();
+	llvm::StringMap<int> reset_map;
+	pruneSiteModels(currentd, site_map, reset_map);
+
+	//blocks are split below, collect them first
+	std::vector<BasicBlock *> bb_vector;
+	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
+	{
+		if(MI->isDeclaration() || MI->hasAvailableExternallyLinkage()) continue;
+		for(Function::iterator FI = MI->begin(), FE = MI->end(); FI != FE; FI++)
+			bb_vector.push_back(FI);
+	}
+
+	for(std::vector<BasicBlock *>::iterator bit = bb_vector.begin(); bit != bb_vector.end(); bit++)
+	{
+		BasicBlock *BB = *bit;
+		Function *F = BB->getParent();
+		std::string key = F->getName().str() + blockName(BB);
+
+		//type1 store goes first, the check below reads pre_bb_num before it
+		Instruction *tail_begin = BB->getTerminator();
+		llvm::StringMap<int>::iterator tit = type1_map.find(key);
+		if(tit != type1_map.end())
+		{
+			Constant *bb_num_value = ConstantInt::get(I64Ty, tit->getValue(), true);
+			gv = M.getGlobalVariable(StringRef("pre_bb_num"), true);
+			IRBuilder<> IRB(BB->getTerminator());
+			tail_begin = IRB.CreateStore(bb_num_value, gv);
+		}
+
+		llvm::StringMap<struct site_model>::iterator sit = site_map.find(key);
+		if(sit == site_map.end()) continue;
+		struct site_model &sm = sit->getValue();
+		//every context pruned, nothing left to check
+		if(sm.contexts.empty()) continue;
+
+		IRBuilder<> IRB1(tail_begin);
+		gv = M.getGlobalVariable(StringRef("current_time"), true);
+		load = IRB1.CreateLoad(gv);
+		gv = M.getGlobalVariable(StringRef("previous_time"), true);
+		LoadInst *last_time_load = IRB1.CreateLoad(gv);
+		IRB1.CreateStore(load, gv);
+		Value *delta = IRB1.CreateSub(load, last_time_load);
+		gv = M.getGlobalVariable(StringRef("pre_bb_num"), true);
+		Value *pre = IRB1.CreateLoad(gv);
+
+		//switch on the context, each case only passes its bounds on
+		BasicBlock *tail = BB->splitBasicBlock(tail_begin);
+		BasicBlock *check = BasicBlock::Create(llvm_context, "", F, tail);
+		IRBuilder<> IRB4(check);
+		PHINode *b_value[TE_MIXTURE_COMPONENTS], *width_value[TE_MIXTURE_COMPONENTS];
+		for(int k = 0; k < TE_MIXTURE_COMPONENTS; k++)
+		{
+			b_value[k] = IRB4.CreatePHI(I64Ty, sm.contexts.size());
+			width_value[k] = IRB4.CreatePHI(I64Ty, sm.contexts.size());
+		}
+		BB->getTerminator()->eraseFromParent();
+		IRBuilder<> IRB5(BB);
+		SwitchInst *context_switch = IRB5.CreateSwitch(pre, tail, sm.contexts.size());
+		for(std::vector<struct context_model>::iterator cit = sm.contexts.begin(); cit != sm.contexts.end(); cit++)
+		{
+			std::vector<double> average_vector, stdev_vector, weight_vector;
+			fitMixture(cit->samples, average_vector, stdev_vector, weight_vector);
+			BasicBlock *pick = BasicBlock::Create(llvm_context, "", F, check);
+			BranchInst::Create(check, pick);
+			context_switch->addCase(cast<ConstantInt>(ConstantInt::get(I64Ty, cit->bb_num, true)), pick);
+			for(int k = 0; k < TE_MIXTURE_COMPONENTS; k++)
+			{
+				//contexts with fewer components repeat the last one
+				size_t j = std::min((size_t)k, average_vector.size() - 1);
+				double b = lowerBound(average_vector[j], stdev_vector[j]);
+				double c = average_vector[j] + page_fault_average - stdev_vector[j] - page_fault_stdev;
+				if(c < b) c = b;
+				if(k == (int)j)
+					errs() << "prior bb num: " << cit->bb_num << " component: " << k << " weight: " << weight_vector[j] << " b: " << b << " c: " << c << "\n";
+				b_value[k]->addIncoming(ConstantInt::get(I64Ty, (long)b, true), pick);
+				width_value[k]->addIncoming(ConstantInt::get(I64Ty, (long)c - (long)b, true), pick);
+			}
+		}
+
+		Value *inside = IRB4.CreateICmpULE(IRB4.CreateSub(delta, b_value[0]), width_value[0]);
+		for(int k = 1; k < TE_MIXTURE_COMPONENTS; k++)
+			inside = IRB4.CreateOr(inside, IRB4.CreateICmpULE(IRB4.CreateSub(delta, b_value[k]), width_value[k]));
+
+		//report path
+		BasicBlock *report = BasicBlock::Create(llvm_context, "", F, tail);
+		IRB4.CreateCondBr(inside, tail, report);
+		IRBuilder<> IRB2(report);
+		Value *args[] = {pre, delta, siteId(BB)};
+		IRB2.CreateCall(instru_report_anomaly_f, args);
+		IRB2.CreateBr(tail);
+
+		//get time again after the check
+		IRBuilder<> IRB3(tail->getFirstInsertionPt());
+		gv = M.getGlobalVariable(StringRef("current_time"), true);
+		load = IRB3.CreateLoad(gv);
+		gv = M.getGlobalVariable(StringRef("previous_time"), true);
+		IRB3.CreateStore(load, gv);
+	}
+
+	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
+	{
+		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
+		//handle ecall exit
+		if((strcmp(F->getName().str().c_str(), p_entry_function) == 0) && (M.getFunction(p_reference_function) != NULL))
+			instrumentEcallExit(F, instru_dump_detection_result_f, initial_value_int_zero);
+	}
+
+	instrumentStaticSites(M, static_map);
+	instrumentTimeReset(M, reset_map);
+	}
+
+
+
+
+	//----------------------Mode 21 for rdtsc training with site records---------------------------//
+	/**
+		copied from Mode 16 without the injection, timed with get_time (rdtsc) like Mode 5 instead of current_time,
+		so training needs no timer thread and can run natively
+		needs compile and run
+		generate: ./tdata.txt, ./ttdata.txt : same as mode 0 but in cycles, rename them to ./trdata.txt, ./ttrdata.txt for mode 22
+	*/
+
+	if(mode == 21)
+	{
+	Value *get_time_f = M.getOrInsertFunction("get_time", I64Ty, I64Ty, nullptr);
+
+	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
+	{
+		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
+		for(Function::iterator FI = MI->begin(), FE = MI->end(); FI != FE; FI++)
+		{
+			BasicBlock *BB = FI;
+			//get insert point: the end of the basic block
+			IRBuilder<> IRB(BB->getTerminator());
+			Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
+			Constant *str_para2 = createStringArg((char *)blockName(BB).c_str(), F);
+
+			//type 2 nodes
+			if(isType2Block(BB))
+			{
+				//get time before our time consuming process
+				CallInst *get = IRB.CreateCall(get_time_f, initial_value_int_zero);
 				gv = M.getGlobalVariable(StringRef("previous_time"), true);
-				LoadInst *last_time_load = IRB1.CreateLoad(gv);
-				IRB1.CreateStore(load, gv);
-				Value *detect_result_sub_inst = IRB1.CreateSub(load, last_time_load);
+				LoadInst *last_time_load = IRB.CreateLoad(gv);
+				IRB.CreateStore(get, gv);
 
-				int vector_size = bb_num_vector2.size();
-				int my_i;
-				myit1 = average_vector2.begin();
-				myit2 = stdev_vector2.begin();
-				for(my_i = 0; my_i < vector_size; my_i++)
-				{
-					b_vector3.push_back(*myit1 - *myit2);
-					c_vector3.push_back(*myit1 + page_fault_average - *myit2 - page_fault_stdev);
-					myit1++; myit2++;
-				}
+				Value *sub = IRB.CreateSub(get, last_time_load);
+				Value *args[] = {str_para1, str_para2, sub};
+				//insert record
+				IRB.CreateCall(instru_insert_record_f, args);
 
-				//errs() << "page_fault_average: " << page_fault_average << "page_fault_stdev: " << page_fault_stdev << "\n";
+				//get time again after our time consuming process
+				get = IRB.CreateCall(get_time_f, initial_value_int_zero);
+				gv = M.getGlobalVariable(StringRef("previous_time"), true);
+				IRB.CreateStore(get, gv);
+			}
+			else
+			{
+				//insert a -1 value
+				Value *args[] = {str_para1, str_para2, initial_value_int_minus_one};
+				IRB.CreateCall(instru_insert_record_f, args);
+			}
+		}
 
-				//print for debugging, b_vector3 and c_vector3
-				std::vector<double>::iterator mybit = b_vector3.begin();
-				std::vector<double>::iterator mycit = c_vector3.begin();
-				while((mybit != b_vector3.end()) && (mycit != c_vector3.end()))
+		//dump all timing infomation at the end of ecall
+		if((strcmp(F->getName().str().c_str(), p_entry_function) == 0) && (M.getFunction(p_reference_function) != NULL))
+			instrumentEcallExit(F, instru_dump_result_f, initial_value_int_zero);
+	}
+	}
+
+
+	//----------------------Mode 22 for detection logic instrumentation with an rdtsc trained model---------------------------//
+
+	/**
+		copied from mode 17, the model trained in cycles by mode 21 is translated into ticks of secure_timer
+		./tclockdata.txt : each entry: cycles, ticks, half width of the cycles window, printed by calibrate_clock
+				in timer.c, which has to run once inside the enclave with the timer thread up
+		ticks = slope * cycles fitted by least squares, error: largest residual + slope * largest half width
+		average: slope * average, stdev: slope * stdev plus the variance of the 1..8 tick steps of secure_timer
+		b, c: the mode 12 c, b from lowerBound, widened by the error of the two readings each interval takes
+		./trdata.txt, ./ttrdata.txt : renamed output of mode 21
+	*/
+
+	if(mode == 22)
+	{
+	double slope, clock_error;
+	if(!loadClockFit(currentd, slope, clock_error))
+	{
+		errs() << "Timed Execution Configration Error: ./tclockdata.txt is missing or has less than two samples.\n";
+		exit(-1);
+	}
+
+	llvm::StringMap<struct site_model> site_map;
+	llvm::StringMap<int> type1_map;
+	loadTraceList(currentd, "/trdata.txt", "/ttrdata.txt", "/ttracerdata.txt");
+	buildSiteModels(site_map, type1_map);
+	trace_list.clear();
+	llvm::StringMap<int> reset_map;
+	pruneSiteModels(currentd, site_map, reset_map);
+
+	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
+	{
+		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
+		for(Function::iterator FI = MI->begin(), FE = MI->end(); FI != FE; FI++)
+		{
+			BasicBlock *BB = FI;
+			std::string key = F->getName().str() + blockName(BB);
+
+			//instrument type2 first
+			llvm::StringMap<struct site_model>::iterator sit = site_map.find(key);
+			if(sit != site_map.end())
+			{
+				struct site_model &sm = sit->getValue();
+				std::vector<double> b_vector3, c_vector3;
+				for(std::vector<struct context_model>::iterator cit = sm.contexts.begin(); cit != sm.contexts.end(); cit++)
 				{
-					errs() << "b: " << *mybit << " c: " << *mycit << "\n";
-					mybit++;mycit++;
+					double average = slope * cit->average;
+					double stdev = sqrt(slope * cit->stdev * slope * cit->stdev + average / TE_TIMER_STEP_AVERAGE * TE_TIMER_STEP_VARIANCE);
+					b_vector3.push_back(lowerBound(average, stdev) - 2 * clock_error);
+					c_vector3.push_back(average + page_fault_average - stdev - page_fault_stdev + 2 * clock_error);
+					errs() << "prior bb num: " << cit->bb_num << " cycles: " << cit->average << " " << cit->stdev
+						<< " ticks: " << average << " " << stdev << " b: " << b_vector3.back() << " c: " << c_vector3.back() << "\n";
 				}
+
+				IRBuilder<> IRB1(BB->getTerminator());
+				emitDetectCall(IRB1, BB, sm, b_vector3, c_vector3);
+			}
+
+			llvm::StringMap<int>::iterator tit = type1_map.find(key);
+			if(tit != type1_map.end())
+			{
+				Constant *bb_num_value = ConstantInt::get(I64Ty, tit->getValue(), true);
 				gv = M.getGlobalVariable(StringRef("pre_bb_num"), true);
-				load = IRB1.CreateLoad(gv);
-				myit = bb_num_vector2.begin();
-				mybit = b_vector3.begin();
-				mycit = c_vector3.begin();
-				//if(*mycit < 3) printf("*mycit: %lf\n", *mycit);
+				IRBuilder<> IRB(BB->getTerminator());
+				IRB.CreateStore(bb_num_value, gv);
+			}
+		}
 
+		//handle ecall exit
+		if((strcmp(F->getName().str().c_str(), p_entry_function) == 0) && (M.getFunction(p_reference_function) != NULL))
+			instrumentEcallExit(F, instru_dump_detection_result_f, initial_value_int_zero);
+	}
 
+	instrumentTimeReset(M, reset_map);
+	}
 
 
 
 
-				/*if(vector_size == 1)
-				{
-					Constant *myit_value_int = ConstantInt::get(I64Ty, (int)*myit);
-					Constant *mybit_value_int = ConstantInt::get(I64Ty, (int)*mybit);
-					Constant *mycit_value_int = ConstantInt::get(I64Ty, (int)*mycit);
+	//----------------------Mode 23 for detection logic instrumentation with compact tables---------------------------//
 
+	/**
+		copied from mode 15 with the mode 12 c, b from lowerBound, the contexts and bounds of a site go to one table instead of immediates
+		contexts: type1 blocks store a dense u16 context index into pre_bb_num instead of their bb num,
+			TE_COMPACT_NO_CONTEXT for type1 blocks that are no context of any trained site
+		bounds: b rounded down, c rounded up to multiples of 2^shift, shift per site, u8 when that costs less than
+			1/TE_COMPACT_TOLERANCE of the smallest c of the site, u16 otherwise
+		entries: u16 context, u8 b, u8 c (4 bytes) or u16 context, u16 b, u16 c (6 bytes), see detect.c
+		identical tables are emitted once and shared by every site of the module that has them, tables are private,
+			so identical tables of two modules are not merged
+		the context index is module wide, not relative to the site: the type1 block that stores it is the context of
+			each of its type2 successors, and entry blocks take theirs from the callers, so one stored value has to
+			name the context for every site that can follow it
+		calls instrument_function_detect_compact8 / instrument_function_detect_compact16
+		reported: the table bytes as laid out with their 2 byte alignment, the bytes without sharing, and what the
+			64 bit immediates of mode 15 would have cost
+	*/
 
-					//Constant *mybit_value_double = ConstantFP::get(DoubleTy, *mybit);
-					//Constant *mycit_value_double = ConstantFP::get(DoubleTy, *mycit);
+	if(mode == 23)
+	{
+	Value *instru_detect_compact8_f = M.getOrInsertFunction("instrument_function_detect_compact8", VoidTy, I64Ty, I64Ty, I8PtrTy, I64Ty, I64Ty, I32Ty, nullptr);
+	Value *instru_detect_compact16_f = M.getOrInsertFunction("instrument_function_detect_compact16", VoidTy, I64Ty, I64Ty, I8PtrTy, I64Ty, I64Ty, I32Ty, nullptr);
 
+	llvm::StringMap<struct site_model> site_map;
+	llvm::StringMap<int> type1_map;
+	loadTraceList(currentd);
+	buildSiteModels(site_map, type1_map);
+	llvm::StringMap<double> static_map;
+	estimateStaticSites(M, currentd, site_map, static_map);
+	trace_list.clear();
+	llvm::StringMap<int> reset_map;
+	pruneSiteModels(currentd, site_map, reset_map);
 
+	//dense context indices, in the order contexts first show up
+	std::map<int, int> context_index;
+	for(llvm::StringMap<struct site_model>::iterator sit = site_map.begin(); sit != site_map.end(); sit++)
+		for(std::vector<struct context_model>::iterator cit = sit->getValue().contexts.begin(); cit != sit->getValue().contexts.end(); cit++)
+			if(!context_index.count(cit->bb_num))
+			{
+				int index = context_index.size();
+				context_index[cit->bb_num] = index;
+			}
+	if(context_index.size() >= TE_COMPACT_NO_CONTEXT)
+	{
+		errs() << "Timed Execution Configration Error: " << context_index.size() << " contexts do not fit in u16.\n";
+		exit(-1);
+	}
 
-					//errs() << "*mycit: " << *mycit << "\n";
-					Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-					Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
-					Value *args[] = {load, detect_result_sub_inst, last_time_load, curr, myit_value_int, mybit_value_int, mycit_value_int, str_para1, str_para2};
-					//Value *args[] = {load, detect_result_sub_inst, last_time_load, curr, myit_value_int, mybit_value_double, mycit_value_double, str_para1, str_para2};
+	llvm::StringMap<Constant *> table_cache;
+	unsigned long table_bytes = 0, unshared_bytes = 0, immediate_bytes = 0;
+	int sites = 0, wide_sites = 0;
 
-					//IRBuilder<> IRB(newBB2->getTerminator());
-					IRBuilder<> IRB(BB->getTerminator());
-					IRB.CreateCall(instru_detect1_f, args);
+	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
+	{
+		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
+		for(Function::iterator FI = MI->begin(), FE = MI->end(); FI != FE; FI++)
+		{
+			BasicBlock *BB = FI;
+			std::string key = F->getName().str() + blockName(BB);
+
+			//instrument type2 first
+			llvm::StringMap<struct site_model>::iterator sit = site_map.find(key);
+			if(sit != site_map.end())
+			{
+				struct site_model &sm = sit->getValue();
+				std::vector<double> b_vector3, c_vector3;
+				double c_min = HUGE_VAL, c_max = 0;
+				for(std::vector<struct context_model>::iterator cit = sm.contexts.begin(); cit != sm.contexts.end(); cit++)
+				{
+					b_vector3.push_back(lowerBound(cit->average, cit->stdev));
+					c_vector3.push_back(std::max(b_vector3.back(), cit->average + page_fault_average - cit->stdev - page_fault_stdev));
+					c_min = std::min(c_min, c_vector3.back());
+					c_max = std::max(c_max, c_vector3.back());
 				}
-				else if(vector_size == 2)
+
+				//u8 if its step is fine enough, u16 otherwise
+				int wide = 0;
+				int shift = compactShift(c_max, 8);
+				if((1 << shift) * TE_COMPACT_TOLERANCE > c_min && shift > 0)
 				{
-					Constant *myit_value_int = ConstantInt::get(I64Ty, *myit);
-					Constant *mybit_value_int = ConstantInt::get(I64Ty, *mybit);
-					Constant *mycit_value_int = ConstantInt::get(I64Ty, *mycit);
-					Constant *myit1_value_int = ConstantInt::get(I64Ty, *(myit+1));
-					Constant *mybit1_value_int = ConstantInt::get(I64Ty, *(mybit+1));
-					Constant *mycit1_value_int = ConstantInt::get(I64Ty, *(mycit+1));
-					Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-					Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
-					Value *args[] = {load, detect_result_sub_inst, last_time_load, curr, myit_value_int, mybit_value_int, mycit_value_int,
-								myit1_value_int, mybit1_value_int, mycit1_value_int, str_para1, str_para2};
-					//IRBuilder<> IRB(newBB2->getTerminator());
-					IRBuilder<> IRB(BB->getTerminator());
-					IRB.CreateCall(instru_detect2_f, args);
+					wide = 1;
+					shift = compactShift(c_max, 16);
 				}
-				else if(vector_size == 3)
+
+				std::vector<uint8_t> table;
+				for(size_t i = 0; i < sm.contexts.size(); i++)
 				{
-					Constant *myit_value_int = ConstantInt::get(I64Ty, *myit);
-					Constant *mybit_value_int = ConstantInt::get(I64Ty, *mybit);
-					Constant *mycit_value_int = ConstantInt::get(I64Ty, *mycit);
-					Constant *myit1_value_int = ConstantInt::get(I64Ty, *(myit+1));
-					Constant *mybit1_value_int = ConstantInt::get(I64Ty, *(mybit+1));
-					Constant *mycit1_value_int = ConstantInt::get(I64Ty, *(mycit+1));
-					Constant *myit2_value_int = ConstantInt::get(I64Ty, *(myit+2));
-					Constant *mybit2_value_int = ConstantInt::get(I64Ty, *(mybit+2));
-					Constant *mycit2_value_int = ConstantInt::get(I64Ty, *(mycit+2));
-					Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-					Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
-					Value *args[] = {load, detect_result_sub_inst, last_time_load, curr, myit_value_int, mybit_value_int, mycit_value_int,
-								myit1_value_int, mybit1_value_int, mycit1_value_int,
-								myit2_value_int, mybit2_value_int, mycit2_value_int, str_para1, str_para2};
-					//IRBuilder<> IRB(newBB2->getTerminator());
-					IRBuilder<> IRB(BB->getTerminator());
-					IRB.CreateCall(instru_detect3_f, args);
+					unsigned long ctx = context_index[sm.contexts[i].bb_num];
+					unsigned long b = (unsigned long)b_vector3[i] >> shift;
+					unsigned long c = ((unsigned long)ceil(c_vector3[i]) + (1UL << shift) - 1) >> shift;
+					table.push_back(ctx & 0xff); table.push_back(ctx >> 8);
+					table.push_back(b & 0xff);
+					if(wide) table.push_back(b >> 8);
+					table.push_back(c & 0xff);
+					if(wide) table.push_back(c >> 8);
+				}
+
+				std::string table_key = std::string(1, (char)wide) + std::string(table.begin(), table.end());
+				Constant *&table_para = table_cache[table_key];
+				if(table_para == NULL)
+				{
+					table_para = createTableArg(ConstantDataArray::get(llvm_context, table), F, ".te_compact");
+					cast<GlobalVariable>(table_para->getOperand(0))->setAlignment(2);
+					table_bytes += (table.size() + 1) & ~1UL;
+				}
+				unshared_bytes += (table.size() + 1) & ~1UL;
+				immediate_bytes += sm.contexts.size() * 3 * 8;
+				sites++;
+				wide_sites += wide;
+
+				IRBuilder<> IRB1(BB->getTerminator());
+				gv = M.getGlobalVariable(StringRef("current_time"), true);
+				load = IRB1.CreateLoad(gv);
+				gv = M.getGlobalVariable(StringRef("previous_time"), true);
+				LoadInst *last_time_load = IRB1.CreateLoad(gv);
+				IRB1.CreateStore(load, gv);
+				Value *detect_result_sub_inst = IRB1.CreateSub(load, last_time_load);
+				gv = M.getGlobalVariable(StringRef("pre_bb_num"), true);
+				load = IRB1.CreateLoad(gv);
+				Value *args[] = {load, detect_result_sub_inst, table_para, ConstantInt::get(I64Ty, sm.contexts.size()), ConstantInt::get(I64Ty, shift), siteId(BB)};
+				IRB1.CreateCall(wide ? instru_detect_compact16_f : instru_detect_compact8_f, args);
+
+				gv = M.getGlobalVariable(StringRef("current_time"), true);
+				load = IRB1.CreateLoad(gv);
+				gv = M.getGlobalVariable(StringRef("previous_time"), true);
+				IRB1.CreateStore(load, gv);
+			}
+
+			llvm::StringMap<int>::iterator tit = type1_map.find(key);
+			if(tit != type1_map.end())
+			{
+				std::map<int, int>::iterator iit = context_index.find(tit->getValue());
+				Constant *bb_num_value = ConstantInt::get(I64Ty, iit != context_index.end() ? iit->second : TE_COMPACT_NO_CONTEXT, true);
+				gv = M.getGlobalVariable(StringRef("pre_bb_num"), true);
+				IRBuilder<> IRB(BB->getTerminator());
+				IRB.CreateStore(bb_num_value, gv);
+			}
+		}
+
+		//handle ecall exit
+		if((strcmp(F->getName().str().c_str(), p_entry_function) == 0) && (M.getFunction(p_reference_function) != NULL))
+			instrumentEcallExit(F, instru_dump_detection_result_f, initial_value_int_zero);
+	}
+
+	instrumentStaticSites(M, static_map);
+	instrumentTimeReset(M, reset_map);
+	errs() << "compact tables: " << sites << " sites (" << wide_sites << " u16), " << table_cache.size() << " distinct tables, "
+		<< table_bytes << " bytes (" << unshared_bytes << " unshared), " << context_index.size() << " contexts (immediates: "
+		<< immediate_bytes << " bytes)\n";
+	}
+
+
+
+
+	//----------------------Mode 24 for detection logic instrumentation with input class models---------------------------//
+
+	/**
+		copied from mode 15 with the mode 12 c, b from lowerBound, one model per input class instead of one for every request
+		training: run mode 0 once per class and rename its output to ./tdata<k>.txt, ./ttdata<k>.txt, k = 0, 1, ...
+			classes are read until the first missing k, at most TE_MAX_INPUT_CLASSES
+		the ecall entry calls instrument_function_set_input_class with the arguments of the ecall, each widened to
+			64 bits, which asks the enclave for the class of the request (instrument_function_classify_input, 0 by
+			default) and keeps it in te_input_class
+		pruned contexts and the budget of class k go to ./tprunedata<k>.txt, ./tbudgetdata<k>.txt
+		every site has an array of per class table pointers, the check loads the one of te_input_class and calls
+			instrument_function_detect_table, table: n, then n (context, b, c)
+		a class that never reached the site gets the empty table
+	*/
+
+	if(mode == 24)
+	{
+	PointerType *I64PtrTy = Type::getInt64PtrTy(llvm_context);
+	Value *instru_set_input_class_f = M.getOrInsertFunction("instrument_function_set_input_class", VoidTy, I64Ty, I64PtrTy, I64Ty, nullptr);
+	Value *instru_detect_table_f = M.getOrInsertFunction("instrument_function_detect_table", VoidTy, I64Ty, I64Ty, I64PtrTy, I32Ty, nullptr);
+	//already there when linkRuntime brought the runtime in
+	gv = M.getGlobalVariable(StringRef("te_input_class"), true);
+	if(gv == NULL)
+	{
+		gv = new GlobalVariable(M, I64Ty, false, GlobalValue::AvailableExternallyLinkage, 0, "te_input_class");
+		gv->setInitializer(initial_value_int_zero);
+	}
+
+	llvm::StringMap<struct site_model> class_map[TE_MAX_INPUT_CLASSES];
+	llvm::StringMap<int> type1_map, reset_map;
+	int classes;
+	for(classes = 0; classes < TE_MAX_INPUT_CLASSES; classes++)
+	{
+		char data_name[40], trace_name[40], cache_name[40], prune_name[40], budget_name[40], tctemp[300];
+		sprintf(data_name, "/tdata%d.txt", classes);
+		sprintf(trace_name, "/ttdata%d.txt", classes);
+		sprintf(cache_name, "/ttracedata%d.txt", classes);
+		sprintf(prune_name, "/tprunedata%d.txt", classes);
+		sprintf(budget_name, "/tbudgetdata%d.txt", classes);
+		strcpy(tctemp, currentd);
+		strcat(tctemp, data_name);
+		if(access(tctemp, 0) == -1) break;
+
+		loadTraceList(currentd, data_name, trace_name, cache_name);
+		buildSiteModels(class_map[classes], type1_map);
+		trace_list.clear();
+		pruneSiteModels(currentd, class_map[classes], reset_map, prune_name, budget_name);
+	}
+	if(classes == 0)
+	{
+		errs() << "Timed Execution Configration Error: no ./tdata0.txt for input class models.\n";
+		exit(-1);
+	}
+	errs() << "input classes -----> " << classes << "\n";
+
+	//sites checked in any class, reset only those pruned in every class
+	llvm::StringMap<int> site_set;
+	for(int k = 0; k < classes; k++)
+		for(llvm::StringMap<struct site_model>::iterator sit = class_map[k].begin(); sit != class_map[k].end(); sit++)
+		{
+			site_set[sit->getKey()] = 1;
+			reset_map.erase(sit->getKey());
+		}
+
+	ArrayType *ClassArrayTy = ArrayType::get(I64PtrTy, classes);
+	std::vector<uint64_t> empty_table(1, 0);
+	Constant *empty_para = createTableArg(ConstantDataArray::get(llvm_context, empty_table), M.begin(), ".te_class_empty");
+
+	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
+	{
+		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
+		for(Function::iterator FI = MI->begin(), FE = MI->end(); FI != FE; FI++)
+		{
+			BasicBlock *BB = FI;
+			std::string key = F->getName().str() + blockName(BB);
+
+			//instrument type2 first
+			if(site_set.count(key))
+			{
+				std::vector<Constant *> class_tables;
+				for(int k = 0; k < classes; k++)
+				{
+					llvm::StringMap<struct site_model>::iterator sit = class_map[k].find(key);
+					if(sit == class_map[k].end())
+					{
+						class_tables.push_back(empty_para);
+						continue;
+					}
+					struct site_model &sm = sit->getValue();
+					std::vector<uint64_t> table;
+					table.push_back(sm.contexts.size());
+					for(std::vector<struct context_model>::iterator cit = sm.contexts.begin(); cit != sm.contexts.end(); cit++)
+					{
+						table.push_back(cit->bb_num);
+						table.push_back((long)lowerBound(cit->average, cit->stdev));
+						table.push_back((long)(cit->average + page_fault_average - cit->stdev - page_fault_stdev));
+						errs() << "class: " << k << " prior bb num: " << cit->bb_num << " b: " << (long)table[table.size() - 2]
+							<< " c: " << (long)table.back() << "\n";
+					}
+					class_tables.push_back(createTableArg(ConstantDataArray::get(llvm_context, table), F, ".te_class_table"));
+				}
+				GlobalVariable *class_array = new GlobalVariable(M, ClassArrayTy, true, GlobalValue::PrivateLinkage,
+						ConstantArray::get(ClassArrayTy, class_tables), ".te_class");
+
+				IRBuilder<> IRB1(BB->getTerminator());
+				gv = M.getGlobalVariable(StringRef("current_time"), true);
+				load = IRB1.CreateLoad(gv);
+				gv = M.getGlobalVariable(StringRef("previous_time"), true);
+				LoadInst *last_time_load = IRB1.CreateLoad(gv);
+				IRB1.CreateStore(load, gv);
+				Value *detect_result_sub_inst = IRB1.CreateSub(load, last_time_load);
+				gv = M.getGlobalVariable(StringRef("pre_bb_num"), true);
+				load = IRB1.CreateLoad(gv);
+				//the one extra load: the table of the current class
+				gv = M.getGlobalVariable(StringRef("te_input_class"), true);
+				Value *class_indices[] = {initial_value_int_zero, IRB1.CreateLoad(gv)};
+				Value *table = IRB1.CreateLoad(IRB1.CreateInBoundsGEP(class_array, class_indices));
+				Value *args[] = {load, detect_result_sub_inst, table, siteId(BB)};
+				IRB1.CreateCall(instru_detect_table_f, args);
+
+				gv = M.getGlobalVariable(StringRef("current_time"), true);
+				load = IRB1.CreateLoad(gv);
+				gv = M.getGlobalVariable(StringRef("previous_time"), true);
+				IRB1.CreateStore(load, gv);
+			}
+
+			llvm::StringMap<int>::iterator tit = type1_map.find(key);
+			if(tit != type1_map.end())
+			{
+				Constant *bb_num_value = ConstantInt::get(I64Ty, tit->getValue(), true);
+				gv = M.getGlobalVariable(StringRef("pre_bb_num"), true);
+				IRBuilder<> IRB(BB->getTerminator());
+				IRB.CreateStore(bb_num_value, gv);
+			}
+		}
+
+		if((strcmp(F->getName().str().c_str(), p_entry_function) == 0) && (M.getFunction(p_reference_function) != NULL))
+		{
+			//set the class register before the first check, from the arguments of the ecall
+			IRBuilder<> IRB(F->front().getFirstInsertionPt());
+			ArrayType *ArgArrayTy = ArrayType::get(I64Ty, std::max((size_t)1, F->arg_size()));
+			Value *arg_array = IRB.CreateAlloca(ArgArrayTy);
+			long n = 0;
+			for(Function::arg_iterator AI = F->arg_begin(), AE = F->arg_end(); AI != AE; AI++, n++)
+			{
+				Value *arg = AI;
+				Type *ArgTy = arg->getType();
+				if(ArgTy->isPointerTy()) arg = IRB.CreatePtrToInt(arg, I64Ty);
+				else if(ArgTy->isIntegerTy()) arg = IRB.CreateSExtOrTrunc(arg, I64Ty);
+				else if(ArgTy->isFloatingPointTy()) arg = IRB.CreateBitCast(IRB.CreateFPCast(arg, Type::getDoubleTy(llvm_context)), I64Ty);
+				else arg = initial_value_int_zero;
+				Value *arg_indices[] = {initial_value_int_zero, ConstantInt::get(I64Ty, n)};
+				IRB.CreateStore(arg, IRB.CreateInBoundsGEP(arg_array, arg_indices));
+			}
+			Value *first_indices[] = {initial_value_int_zero, initial_value_int_zero};
+			Value *args[] = {ConstantInt::get(I64Ty, classes), IRB.CreateInBoundsGEP(arg_array, first_indices), ConstantInt::get(I64Ty, n)};
+			IRB.CreateCall(instru_set_input_class_f, args);
+
+			//handle ecall exit
+			instrumentEcallExit(F, instru_dump_detection_result_f, initial_value_int_zero);
+		}
+	}
+
+	instrumentTimeReset(M, reset_map);
+	}
+
+
+
+
+	//----------------------Mode 25 for detection with online threshold refinement---------------------------//
+
+	/**
+		copied from mode 20, every (site, context) keeps an EWMA of its accepted deltas in a private global of the site,
+		started at the trained average, and the bound follows it: c = EWMA + (trained c - trained average)
+		trained c: the mode 12 bound, the moving c is clamped to trained c * (1 -/+ TE_EWMA_CLAMP) at compile time,
+			so no sequence of accepted deltas can open it further
+		update: EWMA += (delta - EWMA) >> TE_EWMA_SHIFT, stored through a select, no branch and no allocation
+		a switch on pre_bb_num picks the EWMA slot, offset and clamp of every kept context, one slot per context,
+		contexts pruned or never trained go to the default and are not checked, as in mode 26
+		calls instrument_function_report_anomaly only when delta is above c
+	*/
+
+	if(mode == 25)
+	{
+	Value *instru_report_anomaly_f = M.getOrInsertFunction("instrument_function_report_anomaly", VoidTy, I64Ty, I64Ty, I32Ty, nullptr);
+	Constant *ewma_shift_value = ConstantInt::get(I64Ty, TE_EWMA_SHIFT);
+	Constant *zero32 = ConstantInt::get(Type::getInt32Ty(llvm_context), 0);
+
+	llvm::StringMap<struct site_model> site_map;
+	llvm::StringMap<int> type1_map;
+	loadTraceList(currentd);
+	buildSiteModels(site_map, type1_map);
+	llvm::StringMap<double> static_map;
+	estimateStaticSites(M, currentd, site_map, static_map);
+	trace_list.clear();
+	llvm::StringMap<int> reset_map;
+	pruneSiteModels(currentd, site_map, reset_map);
+
+	//blocks are split below, collect them first
+	std::vector<BasicBlock *> bb_vector;
+	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
+	{
+		if(MI->isDeclaration() || MI->hasAvailableExternallyLinkage()) continue;
+		for(Function::iterator FI = MI->begin(), FE = MI->end(); FI != FE; FI++)
+			bb_vector.push_back(FI);
+	}
+
+	for(std::vector<BasicBlock *>::iterator bit = bb_vector.begin(); bit != bb_vector.end(); bit++)
+	{
+		BasicBlock *BB = *bit;
+		Function *F = BB->getParent();
+		std::string key = F->getName().str() + blockName(BB);
+
+		//type1 store goes first, the check below reads pre_bb_num before it
+		Instruction *tail_begin = BB->getTerminator();
+		llvm::StringMap<int>::iterator tit = type1_map.find(key);
+		if(tit != type1_map.end())
+		{
+			Constant *bb_num_value = ConstantInt::get(I64Ty, tit->getValue(), true);
+			gv = M.getGlobalVariable(StringRef("pre_bb_num"), true);
+			IRBuilder<> IRB(BB->getTerminator());
+			tail_begin = IRB.CreateStore(bb_num_value, gv);
+		}
+
+		llvm::StringMap<struct site_model>::iterator sit = site_map.find(key);
+		if(sit == site_map.end()) continue;
+		struct site_model &sm = sit->getValue();
+		//every context pruned, nothing left to check
+		if(sm.contexts.empty()) continue;
+
+		//the EWMA state, one slot per context
+		std::vector<uint64_t> state_table;
+		for(std::vector<struct context_model>::iterator cit = sm.contexts.begin(); cit != sm.contexts.end(); cit++)
+			state_table.push_back((long)cit->average);
+		GlobalVariable *state = new GlobalVariable(M, ArrayType::get(I64Ty, state_table.size()), false, GlobalValue::PrivateLinkage,
+				ConstantDataArray::get(llvm_context, state_table), ".te_ewma");
+
+		IRBuilder<> IRB1(tail_begin);
+		gv = M.getGlobalVariable(StringRef("current_time"), true);
+		load = IRB1.CreateLoad(gv);
+		gv = M.getGlobalVariable(StringRef("previous_time"), true);
+		LoadInst *last_time_load = IRB1.CreateLoad(gv);
+		IRB1.CreateStore(load, gv);
+		Value *delta = IRB1.CreateSub(load, last_time_load);
+		gv = M.getGlobalVariable(StringRef("pre_bb_num"), true);
+		Value *pre = IRB1.CreateLoad(gv);
+
+		//switch on the context, each case only passes its slot, offset and clamp on
+		BasicBlock *tail = BB->splitBasicBlock(tail_begin);
+		BasicBlock *check = BasicBlock::Create(llvm_context, "", F, tail);
+		IRBuilder<> IRB4(check);
+		PHINode *state_ptr = IRB4.CreatePHI(Type::getInt64PtrTy(llvm_context), sm.contexts.size());
+		PHINode *offset = IRB4.CreatePHI(I64Ty, sm.contexts.size());
+		PHINode *low = IRB4.CreatePHI(I64Ty, sm.contexts.size());
+		PHINode *high = IRB4.CreatePHI(I64Ty, sm.contexts.size());
+		BB->getTerminator()->eraseFromParent();
+		IRBuilder<> IRB5(BB);
+		SwitchInst *context_switch = IRB5.CreateSwitch(pre, tail, sm.contexts.size());
+		for(size_t i = 0; i < sm.contexts.size(); i++)
+		{
+			struct context_model &cm = sm.contexts[i];
+			double c = std::max(cm.average, cm.average + page_fault_average - cm.stdev - page_fault_stdev);
+			errs() << "prior bb num: " << cm.bb_num << " c: " << c << " clamp: " << (long)(c * (1 - TE_EWMA_CLAMP)) << " " << (long)(c * (1 + TE_EWMA_CLAMP)) << "\n";
+			BasicBlock *pick = BasicBlock::Create(llvm_context, "", F, check);
+			BranchInst::Create(check, pick);
+			context_switch->addCase(cast<ConstantInt>(ConstantInt::get(I64Ty, cm.bb_num, true)), pick);
+			Constant *state_indices[] = {zero32, ConstantInt::get(Type::getInt32Ty(llvm_context), i)};
+			state_ptr->addIncoming(ConstantExpr::getInBoundsGetElementPtr(state, state_indices), pick);
+			offset->addIncoming(ConstantInt::get(I64Ty, (long)(c - cm.average), true), pick);
+			low->addIncoming(ConstantInt::get(I64Ty, (long)(c * (1 - TE_EWMA_CLAMP)), true), pick);
+			high->addIncoming(ConstantInt::get(I64Ty, (long)(c * (1 + TE_EWMA_CLAMP)), true), pick);
+		}
+
+		Value *ewma = IRB4.CreateLoad(state_ptr);
+		Value *bound = IRB4.CreateAdd(ewma, offset);
+		bound = IRB4.CreateSelect(IRB4.CreateICmpULT(bound, low), low, bound);
+		bound = IRB4.CreateSelect(IRB4.CreateICmpUGT(bound, high), high, bound);
+		Value *accepted = IRB4.CreateICmpULE(delta, bound);
+
+		//learn from accepted deltas only
+		Value *moved = IRB4.CreateAdd(ewma, IRB4.CreateAShr(IRB4.CreateSub(delta, ewma), ewma_shift_value));
+		IRB4.CreateStore(IRB4.CreateSelect(accepted, moved, ewma), state_ptr);
+
+		//report path
+		BasicBlock *report = BasicBlock::Create(llvm_context, "", F, tail);
+		IRB4.CreateCondBr(accepted, tail, report);
+		IRBuilder<> IRB2(report);
+		Value *args[] = {pre, delta, siteId(BB)};
+		IRB2.CreateCall(instru_report_anomaly_f, args);
+		IRB2.CreateBr(tail);
+
+		//get time again after the check
+		IRBuilder<> IRB3(tail->getFirstInsertionPt());
+		gv = M.getGlobalVariable(StringRef("current_time"), true);
+		load = IRB3.CreateLoad(gv);
+		gv = M.getGlobalVariable(StringRef("previous_time"), true);
+		IRB3.CreateStore(load, gv);
+	}
+
+	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
+	{
+		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
+		//handle ecall exit
+		if((strcmp(F->getName().str().c_str(), p_entry_function) == 0) && (M.getFunction(p_reference_function) != NULL))
+			instrumentEcallExit(F, instru_dump_detection_result_f, initial_value_int_zero);
+	}
+
+	instrumentStaticSites(M, static_map);
+	instrumentTimeReset(M, reset_map);
+	}
+
+
+
+
+	//----------------------Mode 26 for inline detection logic---------------------------//
+
+	/**
+		copied from mode 15 with the mode 12 c, b from lowerBound, the check is emitted as IR instead of a call:
+			switch on pre_bb_num over the contexts of the site, then one unsigned compare per context,
+			delta - b <= c - b, and a branch to one cold block of the site that calls instrument_function_report_anomaly
+		unknown contexts go straight to the end of the block, nothing is spilled for a call on the hot path
+		line 13 of tconfig.txt set to 1 times every check with get_time in this mode and in mode 15,
+			instrument_function_dump_check_cycles prints the average at the end of ecall, to compare the two
+	*/
+
+	if(mode == 26)
+	{
+	Value *instru_report_anomaly_f = M.getOrInsertFunction("instrument_function_report_anomaly", VoidTy, I64Ty, I64Ty, I32Ty, nullptr);
+
+	llvm::StringMap<struct site_model> site_map;
+	llvm::StringMap<int> type1_map;
+	loadTraceList(currentd);
+	buildSiteModels(site_map, type1_map);
+	llvm::StringMap<double> static_map;
+	estimateStaticSites(M, currentd, site_map, static_map);
+	trace_list.clear();
+	llvm::StringMap<int> reset_map;
+	pruneSiteModels(currentd, site_map, reset_map);
+
+	//blocks are split below, collect them first
+	std::vector<BasicBlock *> bb_vector;
+	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
+	{
+		if(MI->isDeclaration() || MI->hasAvailableExternallyLinkage()) continue;
+		for(Function::iterator FI = MI->begin(), FE = MI->end(); FI != FE; FI++)
+			bb_vector.push_back(FI);
+	}
+
+	for(std::vector<BasicBlock *>::iterator bit = bb_vector.begin(); bit != bb_vector.end(); bit++)
+	{
+		BasicBlock *BB = *bit;
+		Function *F = BB->getParent();
+		std::string key = F->getName().str() + blockName(BB);
+
+		//type1 store goes first, the check below reads pre_bb_num before it
+		Instruction *tail_begin = BB->getTerminator();
+		llvm::StringMap<int>::iterator tit = type1_map.find(key);
+		if(tit != type1_map.end())
+		{
+			Constant *bb_num_value = ConstantInt::get(I64Ty, tit->getValue(), true);
+			gv = M.getGlobalVariable(StringRef("pre_bb_num"), true);
+			IRBuilder<> IRB(BB->getTerminator());
+			tail_begin = IRB.CreateStore(bb_num_value, gv);
+		}
+
+		llvm::StringMap<struct site_model>::iterator sit = site_map.find(key);
+		if(sit == site_map.end()) continue;
+		struct site_model &sm = sit->getValue();
+
+		IRBuilder<> IRB1(tail_begin);
+		Value *check_begin = beginCheckTiming(IRB1);
+		gv = M.getGlobalVariable(StringRef("current_time"), true);
+		load = IRB1.CreateLoad(gv);
+		gv = M.getGlobalVariable(StringRef("previous_time"), true);
+		LoadInst *last_time_load = IRB1.CreateLoad(gv);
+		IRB1.CreateStore(load, gv);
+		Value *delta = IRB1.CreateSub(load, last_time_load);
+		gv = M.getGlobalVariable(StringRef("pre_bb_num"), true);
+		Value *pre = IRB1.CreateLoad(gv);
+
+		BasicBlock *tail = BB->splitBasicBlock(tail_begin);
+		BasicBlock *report = BasicBlock::Create(llvm_context, "", F, tail);
+		IRBuilder<> IRB2(report);
+		Value *args[] = {pre, delta, siteId(BB)};
+		IRB2.CreateCall(instru_report_anomaly_f, args);
+		IRB2.CreateBr(tail);
+
+		BB->getTerminator()->eraseFromParent();
+		IRBuilder<> IRB4(BB);
+		SwitchInst *context_switch = IRB4.CreateSwitch(pre, tail, sm.contexts.size());
+		for(std::vector<struct context_model>::iterator cit = sm.contexts.begin(); cit != sm.contexts.end(); cit++)
+		{
+			double b = lowerBound(cit->average, cit->stdev);
+			double c = std::max(b, cit->average + page_fault_average - cit->stdev - page_fault_stdev);
+			BasicBlock *check = BasicBlock::Create(llvm_context, "", F, report);
+			IRBuilder<> IRB5(check);
+			Value *inside = IRB5.CreateICmpULE(IRB5.CreateSub(delta, ConstantInt::get(I64Ty, (long)b, true)), ConstantInt::get(I64Ty, (long)c - (long)b, true));
+			IRB5.CreateCondBr(inside, tail, report);
+			context_switch->addCase(cast<ConstantInt>(ConstantInt::get(I64Ty, cit->bb_num, true)), check);
+		}
+
+		//get time again after the check
+		IRBuilder<> IRB3(tail->getFirstInsertionPt());
+		gv = M.getGlobalVariable(StringRef("current_time"), true);
+		load = IRB3.CreateLoad(gv);
+		gv = M.getGlobalVariable(StringRef("previous_time"), true);
+		IRB3.CreateStore(load, gv);
+		endCheckTiming(IRB3, check_begin);
+	}
+
+	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
+	{
+		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
+		//handle ecall exit
+		if((strcmp(F->getName().str().c_str(), p_entry_function) == 0) && (M.getFunction(p_reference_function) != NULL))
+		{
+			instrumentEcallExit(F, instru_dump_detection_result_f, initial_value_int_zero);
+			if(measure_checks)
+				instrumentEcallExit(F, instru_dump_check_cycles_f, initial_value_int_zero);
+		}
+	}
+
+	instrumentStaticSites(M, static_map);
+	instrumentTimeReset(M, reset_map);
+	}
+
+
+
+	//----------------------Mode 27 for detection with loop aggregated checks---------------------------//
+
+	/**
+		copied from mode 22 with the mode 12 c, b from lowerBound, innermost loops that have a preheader and dedicated exits
+		and showed up in the trace get one check per run of the loop instead of one per iteration
+		training: the mode 0 trace, see buildLoopModels, a run of a loop is the sum of the deltas recorded from its first
+			header record to the last record before a block of the same function outside the loop, calls included
+		trips: header executions, backedge taken count + 1 expanded by SCEV in the preheader, or counted in the header
+			when SCEV can not compute it
+		runtime: the preheader keeps previous_time as the start, sites inside the loop only restart the interval,
+			each exit checks previous_time - start, scaled by 2^TE_LOOP_FRACTION_BITS, against
+			[trips * average - spread, trips * average + spread + allowance], spread = stdev * sqrt(trips),
+			the stdev of a run of trips iterations, stdev being per sqrt(iteration), see buildLoopModels,
+			allowance = page fault average - page fault stdev, one page fault per run like mode 12
+		calls instrument_function_loop_anomaly only when the run is outside its bounds
+		./tloopdata.txt : each entry: function name, header bb name, runs, per iteration average, stdev
+	*/
+
+	if(mode == 27)
+	{
+	Value *instru_loop_anomaly_f = M.getOrInsertFunction("instrument_function_loop_anomaly", VoidTy, I64Ty, I64Ty, I32Ty, nullptr);
+	Constant *fraction_bits_value = ConstantInt::get(I64Ty, TE_LOOP_FRACTION_BITS);
+	Type *DoubleTy = Type::getDoubleTy(llvm_context);
+	Value *sqrt_f = Intrinsic::getDeclaration(&M, Intrinsic::sqrt, DoubleTy);
+
+	llvm::StringMap<struct site_model> site_map;
+	llvm::StringMap<int> type1_map;
+	loadTraceList(currentd);
+	buildSiteModels(site_map, type1_map);
+	trace_list.clear();
+	llvm::StringMap<int> reset_map;
+	pruneSiteModels(currentd, site_map, reset_map);
+	llvm::StringMap<struct loop_model> loop_map;
+	buildLoopModels(M, currentd, loop_map);
+
+	int aggregated = 0;
+	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
+	{
+		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
+
+		//loops with a model, their trips and start are set up before the sites of the preheader are instrumented
+		ScalarEvolution &SE = getAnalysis<ScalarEvolution>(*F);
+		LoopInfo &LI = getAnalysis<LoopInfo>(*F);
+		std::vector<Loop *> loop_vector, all_vector;
+		for(LoopInfo::iterator LII = LI.begin(), LIE = LI.end(); LII != LIE; LII++)
+			collectInnerLoops(*LII, all_vector);
+
+		std::vector<Value *> trips_vector;
+		std::set<BasicBlock *> loop_blocks;
+		SCEVExpander Expander(SE, "te.trips");
+		for(std::vector<Loop *>::iterator lit = all_vector.begin(); lit != all_vector.end(); lit++)
+		{
+			Loop *L = *lit;
+			if(!loop_map.count(F->getName().str() + blockName(L->getHeader()))) continue;
+
+			Value *trips = NULL;
+			BasicBlock *preheader = L->getLoopPreheader();
+			if(SE.hasLoopInvariantBackedgeTakenCount(L))
+			{
+				const SCEV *taken = SE.getBackedgeTakenCount(L);
+				if(taken->getType()->isIntegerTy() && isSafeToExpand(taken, SE))
+					trips = Expander.expandCodeFor(SE.getAddExpr(SE.getNoopOrZeroExtend(taken, I64Ty), SE.getConstant(I64Ty, 1)),
+							I64Ty, preheader->getTerminator());
+			}
+			if(trips == NULL)
+			{
+				IRBuilder<> IRB(F->getEntryBlock().getFirstInsertionPt());
+				AllocaInst *counter = IRB.CreateAlloca(I64Ty, nullptr, "te.trips");
+				IRBuilder<> IRB1(preheader->getTerminator());
+				IRB1.CreateStore(initial_value_int_zero, counter);
+				IRBuilder<> IRB2(L->getHeader()->getFirstInsertionPt());
+				IRB2.CreateStore(IRB2.CreateAdd(IRB2.CreateLoad(counter), initial_value_int_one), counter);
+				trips = counter;
+			}
+
+			loop_vector.push_back(L);
+			trips_vector.push_back(trips);
+			loop_blocks.insert(L->block_begin(), L->block_end());
+		}
+
+		for(Function::iterator FI = MI->begin(), FE = MI->end(); FI != FE; FI++)
+		{
+			BasicBlock *BB = FI;
+			std::string key = F->getName().str() + blockName(BB);
+
+			//instrument type2 first, sites inside an aggregated loop only restart the interval
+			llvm::StringMap<struct site_model>::iterator sit = site_map.find(key);
+			if(sit != site_map.end() && loop_blocks.count(BB))
+				reset_map[key] = 1;
+			else if(sit != site_map.end())
+			{
+				struct site_model &sm = sit->getValue();
+				std::vector<double> b_vector3, c_vector3;
+				for(std::vector<struct context_model>::iterator cit = sm.contexts.begin(); cit != sm.contexts.end(); cit++)
+				{
+					b_vector3.push_back(lowerBound(cit->average, cit->stdev));
+					c_vector3.push_back(cit->average + page_fault_average - cit->stdev - page_fault_stdev);
+				}
+
+				IRBuilder<> IRB1(BB->getTerminator());
+				emitDetectCall(IRB1, BB, sm, b_vector3, c_vector3);
+			}
+
+			llvm::StringMap<int>::iterator tit = type1_map.find(key);
+			if(tit != type1_map.end())
+			{
+				Constant *bb_num_value = ConstantInt::get(I64Ty, tit->getValue(), true);
+				gv = M.getGlobalVariable(StringRef("pre_bb_num"), true);
+				IRBuilder<> IRB(BB->getTerminator());
+				IRB.CreateStore(bb_num_value, gv);
+			}
+		}
+
+		for(size_t i = 0; i < loop_vector.size(); i++)
+		{
+			Loop *L = loop_vector[i];
+			BasicBlock *header = L->getHeader();
+			struct loop_model &lm = loop_map[F->getName().str() + blockName(header)];
+			double allowance = std::max(0.0, page_fault_average - page_fault_stdev);
+			Constant *average_value = ConstantInt::get(I64Ty, (long)(lm.average * (1 << TE_LOOP_FRACTION_BITS)));
+			Constant *stdev_value = ConstantFP::get(DoubleTy, lm.stdev * (1 << TE_LOOP_FRACTION_BITS));
+			Constant *allowance_value = ConstantInt::get(I64Ty, (long)(allowance * (1 << TE_LOOP_FRACTION_BITS)));
+			errs() << "loop: " << F->getName() << " " << blockName(header) << " average: " << lm.average << " stdev: " << lm.stdev << "\n";
+
+			//start of the run, after the site of the preheader restarted the interval
+			IRBuilder<> IRB(L->getLoopPreheader()->getTerminator());
+			//a preheader left without a check restarts it here, instrumentTimeReset would put it after the start
+			std::string preheader_key = F->getName().str() + blockName(L->getLoopPreheader());
+			if(reset_map.count(preheader_key))
+			{
+				gv = M.getGlobalVariable(StringRef("current_time"), true);
+				load = IRB.CreateLoad(gv);
+				IRB.CreateStore(load, M.getGlobalVariable(StringRef("previous_time"), true));
+				reset_map.erase(preheader_key);
+			}
+			gv = M.getGlobalVariable(StringRef("previous_time"), true);
+			Value *start = IRB.CreateLoad(gv);
+
+			SmallVector<BasicBlock *, 8> exit_vector;
+			L->getUniqueExitBlocks(exit_vector);
+			for(SmallVector<BasicBlock *, 8>::iterator eit = exit_vector.begin(); eit != exit_vector.end(); eit++)
+			{
+				Instruction *at = (*eit)->getFirstInsertionPt();
+				IRBuilder<> IRB1(at);
+				Value *trips = trips_vector[i];
+				if(isa<AllocaInst>(trips))
+					trips = IRB1.CreateLoad(trips);
+				gv = M.getGlobalVariable(StringRef("previous_time"), true);
+				Value *total = IRB1.CreateSub(IRB1.CreateLoad(gv), start);
+				//once per run, not per iteration, a negative low bound accepts any short run
+				Value *spread = IRB1.CreateFPToSI(IRB1.CreateFMul(IRB1.CreateCall(sqrt_f, IRB1.CreateUIToFP(trips, DoubleTy)), stdev_value), I64Ty);
+				Value *expected = IRB1.CreateMul(trips, average_value);
+				Value *low = IRB1.CreateSub(expected, spread);
+				Value *high = IRB1.CreateAdd(IRB1.CreateAdd(expected, spread), allowance_value);
+				Value *outside = IRB1.CreateICmpUGT(IRB1.CreateSub(IRB1.CreateShl(total, fraction_bits_value), low), IRB1.CreateSub(high, low));
+
+				TerminatorInst *report_term = SplitBlockAndInsertIfThen(outside, at, false);
+				IRBuilder<> IRB2(report_term);
+				Value *args[] = {trips, total, siteId(header)};
+				IRB2.CreateCall(instru_loop_anomaly_f, args);
+			}
+			aggregated++;
+		}
+
+		//handle ecall exit
+		if((strcmp(F->getName().str().c_str(), p_entry_function) == 0) && (M.getFunction(p_reference_function) != NULL))
+			instrumentEcallExit(F, instru_dump_detection_result_f, initial_value_int_zero);
+	}
+	errs() << "aggregated loops: " << aggregated << "\n";
+
+	instrumentTimeReset(M, reset_map);
+	}
+
+
+
+	//----------------------Mode 28 for detection at function granularity---------------------------//
+
+	/**
+		the functions named in the file on line 15 of tconfig.txt, one per line, every function when the line is empty,
+		are checked once per call instead of once per type2 site, the others like mode 27 without loops
+		training: the mode 0 trace, see buildCallModels, a call lasts from the end of the entry block to the end of
+			the return block, callees included, its context is the caller block holding the call
+		runtime: callers store the site id of their block into te_call_site before direct calls to these functions
+			and before indirect calls, the function takes it at entry and sets it to -1, the context of calls
+			from outside the enclave and of blocks not seen in training
+			start: current_time at the end of the entry block, each return checks current_time - start like mode 26,
+			switch on the context, one compare with the mode 12 c, b from lowerBound, then restarts the interval for the caller
+		the blocks of these functions get no per block instrumentation, with a mixed list only their calls to functions
+			checked per site, and indirect calls, restart the interval and store -1 into pre_bb_num, a context no site
+			was trained with, so the first site of the callee is skipped and the ones after it see trained intervals
+		functions checked per site set te_call_site to -1 at entry, an indirect call that landed in one of them
+			leaves no stale context for the next call from outside the enclave
+		./tcalldata.txt : each entry: function name, context site id, samples, average, stdev
+	*/
+
+	if(mode == 28)
+	{
+	Value *instru_report_anomaly_f = M.getOrInsertFunction("instrument_function_report_anomaly", VoidTy, I64Ty, I64Ty, I32Ty, nullptr);
+	//already there when linkRuntime brought the runtime in
+	gv = M.getGlobalVariable(StringRef("te_call_site"), true);
+	if(gv == NULL)
+	{
+		gv = new GlobalVariable(M, I64Ty, false, GlobalValue::AvailableExternallyLinkage, 0, "te_call_site");
+		gv->setInitializer(initial_value_int_minus_one);
+	}
+
+	//functions checked per call
+	std::set<std::string> coarse_set;
+	if(p_coarse_file[0] != '\0')
+	{
+		char ctemp[450];
+		if(p_coarse_file[0] == '/') strcpy(ctemp, p_coarse_file);
+		else
+		{
+			strcpy(ctemp, currentd);
+			strcat(ctemp, "/");
+			strcat(ctemp, p_coarse_file);
+		}
+		FILE *cfile = fopen(ctemp, "r");
+		if(!cfile)
+		{
+			errs() << "Timed Execution Configration Error: cannot read function list " << ctemp << "\n";
+			exit(-1);
+		}
+		char *line = NULL;
+		size_t len = 0;
+		ssize_t read;
+		while((read = getline(&line, &len, cfile)) != -1)
+		{
+			//leave out last character '\n'
+			if(line[read-1] == '\n') line[read-1] = '\0';
+			if(line[0] != '\0') coarse_set.insert(line);
+		}
+		free(line);
+		fclose(cfile);
+	}
+	else
+	{
+		for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
+			if(!MI->isDeclaration() && !MI->hasAvailableExternallyLinkage())
+				coarse_set.insert(MI->getName().str());
+	}
+	int mixed = p_coarse_file[0] != '\0';
+
+	llvm::StringMap<struct site_model> site_map;
+	llvm::StringMap<int> type1_map;
+	loadTraceList(currentd);
+	buildSiteModels(site_map, type1_map);
+	trace_list.clear();
+	llvm::StringMap<int> reset_map;
+	pruneSiteModels(currentd, site_map, reset_map);
+	llvm::StringMap<struct site_model> call_map;
+	buildCallModels(M, currentd, call_map);
+
+	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
+	{
+		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
+		int coarse = coarse_set.count(F->getName().str());
+
+		//blocks are split below, collect them first
+		std::vector<BasicBlock *> bb_vector;
+		for(Function::iterator FI = MI->begin(), FE = MI->end(); FI != FE; FI++)
+			bb_vector.push_back(FI);
+
+		for(std::vector<BasicBlock *>::iterator bit = bb_vector.begin(); bit != bb_vector.end(); bit++)
+		{
+			BasicBlock *BB = *bit;
+			std::string key = F->getName().str() + blockName(BB);
+
+			//context of the calls checked per call
+			for(BasicBlock::iterator BI = BB->begin(), BE = BB->end(); BI != BE; BI++)
+			{
+				CallInst *CI = dyn_cast<CallInst>(BI);
+				if(CI == NULL || isa<IntrinsicInst>(CI) || CI->isInlineAsm()) continue;
+				Function *callee = CI->getCalledFunction();
+				IRBuilder<> IRB(CI);
+				//a callee checked per site starts from a fresh interval and an untrained context
+				//declarations may be checked per site in another module of the enclave, the runtime is not
+				if(coarse && mixed && (callee == NULL || (!coarse_set.count(callee->getName().str())
+					&& !callee->getName().startswith("instrument_function_") && !callee->getName().startswith("te_"))))
+				{
+					gv = M.getGlobalVariable(StringRef("current_time"), true);
+					load = IRB.CreateLoad(gv);
+					IRB.CreateStore(load, M.getGlobalVariable(StringRef("previous_time"), true));
+					IRB.CreateStore(initial_value_int_minus_one, M.getGlobalVariable(StringRef("pre_bb_num"), true));
+				}
+				if(callee != NULL && !coarse_set.count(callee->getName().str())) continue;
+				IRB.CreateStore(IRB.CreateSExt(siteId(BB), I64Ty), M.getGlobalVariable(StringRef("te_call_site"), true));
+			}
+
+			//no per block instrumentation in functions checked per call, not even the resets of pruned sites
+			if(coarse)
+			{
+				reset_map.erase(key);
+				continue;
+			}
+
+			//type2 first, checked per site
+			llvm::StringMap<struct site_model>::iterator sit = site_map.find(key);
+			if(sit != site_map.end())
+			{
+				struct site_model &sm = sit->getValue();
+				std::vector<double> b_vector3, c_vector3;
+				for(std::vector<struct context_model>::iterator cit = sm.contexts.begin(); cit != sm.contexts.end(); cit++)
+				{
+					b_vector3.push_back(lowerBound(cit->average, cit->stdev));
+					c_vector3.push_back(cit->average + page_fault_average - cit->stdev - page_fault_stdev);
+				}
+
+				IRBuilder<> IRB1(BB->getTerminator());
+				emitDetectCall(IRB1, BB, sm, b_vector3, c_vector3);
+			}
+
+			llvm::StringMap<int>::iterator tit = type1_map.find(key);
+			if(tit != type1_map.end())
+			{
+				Constant *bb_num_value = ConstantInt::get(I64Ty, tit->getValue(), true);
+				gv = M.getGlobalVariable(StringRef("pre_bb_num"), true);
+				IRBuilder<> IRB(BB->getTerminator());
+				IRB.CreateStore(bb_num_value, gv);
+			}
+		}
+
+		//no stale call site context from an indirect call that landed here
+		if(!coarse)
+		{
+			IRBuilder<> IRB(F->getEntryBlock().getFirstInsertionPt());
+			IRB.CreateStore(initial_value_int_minus_one, M.getGlobalVariable(StringRef("te_call_site"), true));
+		}
+
+		llvm::StringMap<struct site_model>::iterator cit = call_map.find(F->getName());
+		if(coarse && cit != call_map.end())
+		{
+			struct site_model &sm = cit->getValue();
+			BasicBlock *entry = &F->getEntryBlock();
+
+			IRBuilder<> IRB(entry->getFirstInsertionPt());
+			gv = M.getGlobalVariable(StringRef("te_call_site"), true);
+			Value *context = IRB.CreateLoad(gv);
+			IRB.CreateStore(initial_value_int_minus_one, gv);
+			IRBuilder<> IRB1(entry->getTerminator());
+			gv = M.getGlobalVariable(StringRef("current_time"), true);
+			Value *start = IRB1.CreateLoad(gv);
+
+			std::vector<Instruction *> return_vector;
+			for(std::vector<BasicBlock *>::iterator bit = bb_vector.begin(); bit != bb_vector.end(); bit++)
+				if(isa<ReturnInst>((*bit)->getTerminator()))
+					return_vector.push_back((*bit)->getTerminator());
+
+			for(std::vector<Instruction *>::iterator rit = return_vector.begin(); rit != return_vector.end(); rit++)
+			{
+				IRBuilder<> IRB2(*rit);
+				gv = M.getGlobalVariable(StringRef("current_time"), true);
+				Value *delta = IRB2.CreateSub(IRB2.CreateLoad(gv), start);
+
+				BasicBlock *BB = (*rit)->getParent();
+				BasicBlock *tail = BB->splitBasicBlock(*rit);
+				BasicBlock *report = BasicBlock::Create(llvm_context, "", F, tail);
+				IRBuilder<> IRB3(report);
+				Value *args[] = {context, delta, siteId(entry)};
+				IRB3.CreateCall(instru_report_anomaly_f, args);
+				IRB3.CreateBr(tail);
+
+				BB->getTerminator()->eraseFromParent();
+				IRBuilder<> IRB4(BB);
+				SwitchInst *context_switch = IRB4.CreateSwitch(context, tail, sm.contexts.size());
+				for(std::vector<struct context_model>::iterator xit = sm.contexts.begin(); xit != sm.contexts.end(); xit++)
+				{
+					double b = lowerBound(xit->average, xit->stdev);
+					double c = std::max(b, xit->average + page_fault_average - xit->stdev - page_fault_stdev);
+					BasicBlock *check = BasicBlock::Create(llvm_context, "", F, report);
+					IRBuilder<> IRB5(check);
+					Value *inside = IRB5.CreateICmpULE(IRB5.CreateSub(delta, ConstantInt::get(I64Ty, (long)b, true)), ConstantInt::get(I64Ty, (long)c - (long)b, true));
+					IRB5.CreateCondBr(inside, tail, report);
+					context_switch->addCase(cast<ConstantInt>(ConstantInt::get(I64Ty, xit->bb_num, true)), check);
+				}
+
+				//restart the interval for the caller
+				IRBuilder<> IRB6(tail->getFirstInsertionPt());
+				gv = M.getGlobalVariable(StringRef("current_time"), true);
+				load = IRB6.CreateLoad(gv);
+				gv = M.getGlobalVariable(StringRef("previous_time"), true);
+				IRB6.CreateStore(load, gv);
+			}
+		}
+
+		//handle ecall exit
+		if((strcmp(F->getName().str().c_str(), p_entry_function) == 0) && (M.getFunction(p_reference_function) != NULL))
+			instrumentEcallExit(F, instru_dump_detection_result_f, initial_value_int_zero);
+	}
+	errs() << "functions checked per call: " << coarse_set.size() << "\n";
+
+	instrumentTimeReset(M, reset_map);
+	}
+
+
+
+	//checks of table driven sites on every N-th execution only
+	sampleChecks(M, currentd);
+
+	//anomaly reports off the hot path
+	outlineReports(M);
+
+	//merge the time bookkeeping of neighbouring instrumentation
+	eliminateTimeRedundancy(M);
+
+	//pre_bb_num in registers within functions
+	localizeContext(M);
+
+	writeSiteSymbols(currentd);
+	return true;
+}
+
+
+/**
+	loadTraceList Function
+	--fill trace_list from tgdata.txt, tdata.txt and ttdata.txt, same processing as mode 12
+	--the processed trace is cached in ./ttracedata.txt and reused when present
+	--other training runs (e.g. mode 16) pass their own data, trace and cache file names
+*/
+void TimedExecution::loadTraceList(char *currentd, const char *data_name, const char *trace_name, const char *cache_name)
+{
+	char ttracetemp[300];
+	strcpy(ttracetemp, currentd);
+	strcat(ttracetemp, cache_name);
+
+	//file exists
+	if(access(ttracetemp, 0) != -1)
+	{
+		FILE *tfile = fopen(ttracetemp, "r");
+		if(!tfile)
+		{
+			errs() << "Timed Execution Configration Error: We should have a processed trace file.\n";
+			exit(-1);
+		}
+		char *line = NULL;
+		size_t len = 0;
+		ssize_t read;
+		int count = 0;
+		struct trace_info ti;
+		while((read = getline(&line, &len, tfile)) != -1)
+		{
+			//leave out last character '\n'
+			line[read-1] = '\0';
+			if(count % 6 == 0) ti.function_name = strdup(line);
+			else if(count % 6 == 1) ti.tail_type2_bb_name = strdup(line);
+			else if(count % 6 == 2) ti.context_type1_function_name = strdup(line);
+			else if(count % 6 == 3) ti.context_type1_bb_name = strdup(line);
+			else if(count % 6 == 4) ti.context_type1_bb_num = atoi(line);
+			else
+			{
+				ti.bb_time = strtoul(line, NULL, 10);
+				trace_list.push_back(ti);
+			}
+			count++;
+		}
+		free(line);
+		fclose(tfile);
+		return;
+	}
+
+	//-------------------processing tgdata.txt-----------------//
+	llvm::StringMap<struct bb_num_s> bbmap;
+	char tgtemp[300];
+	strcpy(tgtemp, currentd);
+	strcat(tgtemp, "/tgdata.txt");
+	FILE *gbfile = fopen(tgtemp, "r");
+	if(!gbfile)
+	{
+		errs() << "Timed Execution Configration Error: We should have a global basic block file.\n";
+		exit(-1);
+	}
+	char *line = NULL;
+	size_t len = 0;
+	ssize_t read;
+	int count = 0;
+	struct bb_num_s bi;
+	while((read = getline(&line, &len, gbfile)) != -1)
+	{
+		//leave out last character '\n'
+		line[read-1] = '\0';
+		if(count % 4 == 0) bi.function_name = strdup(line);
+		else if(count % 4 == 1) bi.bb_name = strdup(line);
+		else if(count % 4 == 2) bi.type1 = atoi(line);
+		else
+		{
+			//type2 and bb global num
+			bi.type2 = atoi(line);
+			bi.bb_num = (count - 3) / 4;
+			bbmap[std::string(bi.function_name) + bi.bb_name] = bi;
+		}
+		count++;
+	}
+	fclose(gbfile);
+
+	//-------------------processing tdata.txt ttdata.txt-----------------//
+	char tgtemp1[300], tgtemp2[300];
+	strcpy(tgtemp1, currentd);
+	strcat(tgtemp1, data_name);
+	strcpy(tgtemp2, currentd);
+	strcat(tgtemp2, trace_name);
+	FILE *datafile = fopen(tgtemp1, "r");
+	if(!datafile)
+	{
+		errs() << "Timed Execution Configration Error: We should have a data file.\n";
+		exit(-1);
+	}
+	FILE *tracefile = fopen(tgtemp2, "r");
+	if(!tracefile)
+	{
+		errs() << "Timed Execution Configration Error: We should have a trace file.\n";
+		exit(-1);
+	}
+	char *line2 = NULL, *line3 = NULL;
+	size_t len2 = 0, len3 = 0;
+	ssize_t read2, read3;
+	while(((read = getline(&line, &len, datafile)) != -1)
+		&& ((read2 = getline(&line2, &len2, tracefile)) != -1)
+		&& ((read3 = getline(&line3, &len3, tracefile)) != -1))
+	{
+		//leave out last character '\n'
+		line[read-1] = '\0';
+		line2[read2-1] = '\0';
+		line3[read3-1] = '\0';
+		struct training_info ti;
+		ti.bb_time = strtoul(line, NULL, 10);
+		ti.function_name = strdup(line2);
+		ti.bb_name = strdup(line3);
+		llvm::StringMap<struct bb_num_s>::iterator mapt = bbmap.find(std::string(line2) + line3);
+		if(mapt == bbmap.end())
+		{
+			errs() << "--------------- mapt == NULL ----------------\n";
+			char tgtemp4[300];
+			strcpy(tgtemp4, currentd);
+			strcat(tgtemp4, "/my2.txt");
+			FILE *file = fopen(tgtemp4, "a");
+			fprintf(file, "%s\n%s\n", ti.function_name, ti.bb_name);
+			fclose(file);
+		}
+		else
+		{
+			ti.bb_num = mapt->getValue().bb_num;
+			ti.type1 = mapt->getValue().type1;
+			ti.type2 = mapt->getValue().type2;
+		}
+		info_list.push_back(ti);
+	}
+	free(line);
+	free(line2);
+	free(line3);
+	fclose(datafile);
+	fclose(tracefile);
+
+	//process trace
+	//collect trace info from trainging info
+	//backwards in training info list
+	int need_type1_bb_num = 0;
+	struct trace_info ti;
+	for(int i = (int)info_list.size() - 1; i >= 0; i--)
+	{
+		struct training_info &it = info_list[i];
+		if(need_type1_bb_num)
+		{
+			ti.context_type1_function_name = strdup(it.function_name);
+			ti.context_type1_bb_name = strdup(it.bb_name);
+			ti.context_type1_bb_num = it.bb_num;
+			//-1: an interval mode 16 did not fault
+			if(ti.bb_time != (unsigned long)-1) trace_list.push_back(ti);
+			need_type1_bb_num = 0;
+		}
+		if(it.type2 == 1)
+		{
+			ti.function_name = strdup(it.function_name);
+			ti.tail_type2_bb_name = strdup(it.bb_name);
+			ti.bb_time = it.bb_time;
+			need_type1_bb_num = 1;
+			//special handling for the entry of the ecall
+			if(i == 0)
+			{
+				ti.context_type1_function_name = strdup(" ");
+				ti.context_type1_bb_name = strdup(" ");
+				ti.context_type1_bb_num = -1;
+				if(ti.bb_time != (unsigned long)-1) trace_list.push_back(ti);
+			}
+		}
+	}
+	info_list.clear();
+
+	//save to file, written aside and renamed so that parallel compiles never see half a cache
+	char ttracetemp1[320];
+	sprintf(ttracetemp1, "%s.%d", ttracetemp, getpid());
+	FILE *file = fopen(ttracetemp1, "w");
+	for(std::vector<struct trace_info>::iterator it = trace_list.begin() ; it != trace_list.end(); it++)
+		fprintf(file, "%s\n%s\n%s\n%s\n%d\n%lu\n",
+			it->function_name, it->tail_type2_bb_name, it->context_type1_function_name, it->context_type1_bb_name, it->context_type1_bb_num, it->bb_time);
+	fclose(file);
+	rename(ttracetemp1, ttracetemp);
+}
+
+
+/**
+	buildSiteModels Function
+	--group trace_list by type2 site and type1 context, keyed by function name + bb name like bbmap
+	--type1_map gets the bb num every context block has to store into pre_bb_num
+*/
+void TimedExecution::buildSiteModels(llvm::StringMap<struct site_model> &site_map, llvm::StringMap<int> &type1_map)
+{
+	for(std::vector<struct trace_info>::iterator it = trace_list.begin() ; it != trace_list.end(); it++)
+	{
+		type1_map[std::string(it->context_type1_function_name) + it->context_type1_bb_name] = it->context_type1_bb_num;
+
+		struct site_model &sm = site_map[std::string(it->function_name) + it->tail_type2_bb_name];
+		if(sm.contexts.empty())
+		{
+			sm.function_name = it->function_name;
+			sm.bb_name = it->tail_type2_bb_name;
+		}
+		size_t i;
+		for(i = 0; i < sm.contexts.size(); i++)
+			if(sm.contexts[i].bb_num == it->context_type1_bb_num) break;
+		if(i == sm.contexts.size())
+		{
+			struct context_model cm;
+			cm.bb_num = it->context_type1_bb_num;
+			sm.contexts.push_back(cm);
+		}
+		sm.contexts[i].samples.push_back(it->bb_time);
+	}
+
+	//calculate average and stdev
+	for(llvm::StringMap<struct site_model>::iterator sit = site_map.begin(); sit != site_map.end(); sit++)
+	{
+		struct site_model &sm = sit->getValue();
+		for(std::vector<struct context_model>::iterator cit = sm.contexts.begin(); cit != sm.contexts.end(); cit++)
+		{
+			double average = 0, stdev = 0;
+			for(std::vector<unsigned long>::iterator myit = cit->samples.begin(); myit != cit->samples.end(); myit++)
+				average += *myit;
+			average /= cit->samples.size();
+			for(std::vector<unsigned long>::iterator myit = cit->samples.begin(); myit != cit->samples.end(); myit++)
+				stdev += (*myit - average) * (*myit - average);
+			stdev /= cit->samples.size();
+			cit->average = average;
+			cit->stdev = sqrt(stdev);
+		}
+	}
+}
+
+
+/**
+	buildSiteDigests Function
+	--build a t-digest per (site, context) from the samples and save them to ./tdigestdata.txt
+	--if ./tdigestdata.txt already exists it is loaded instead, records of the same (site, context)
+	  are merged, so digest files of several training runs can simply be concatenated
+	--each record: function name, bb name, context bb num, centroid count, min, max,
+	  then one "mean weight" line per centroid
+*/
+void TimedExecution::buildSiteDigests(char *currentd, llvm::StringMap<struct site_model> &site_map)
+{
+	char tdtemp[300];
+	strcpy(tdtemp, currentd);
+	strcat(tdtemp, "/tdigestdata.txt");
+
+	FILE *dfile = fopen(tdtemp, "r");
+	if(dfile)
+	{
+		for(llvm::StringMap<struct site_model>::iterator sit = site_map.begin(); sit != site_map.end(); sit++)
+			for(std::vector<struct context_model>::iterator cit = sit->getValue().contexts.begin(); cit != sit->getValue().contexts.end(); cit++)
+				cit->digest = tdigest();
+
+		char *line = NULL;
+		size_t len = 0;
+		ssize_t read;
+		char function_name[300], bb_name[300];
+		int fields = 0;
+		while((read = getline(&line, &len, dfile)) != -1)
+		{
+			//leave out last character '\n'
+			line[read-1] = '\0';
+			if(fields == 0) strcpy(function_name, line);
+			else if(fields == 1) strcpy(bb_name, line);
+			else if(fields == 2)
+			{
+				int bb_num = atoi(line);
+				int centroids = 0;
+				double min = 0, max = 0;
+				if((read = getline(&line, &len, dfile)) != -1) centroids = atoi(line);
+				if((read = getline(&line, &len, dfile)) != -1) min = atof(line);
+				if((read = getline(&line, &len, dfile)) != -1) max = atof(line);
+
+				struct tdigest digest;
+				for(int i = 0; i < centroids && (read = getline(&line, &len, dfile)) != -1; i++)
+				{
+					double mean = 0, weight = 0;
+					sscanf(line, "%lf %lf", &mean, &weight);
+					digest.add(mean, weight);
+				}
+				digest.min = min;
+				digest.max = max;
+
+				struct site_model &sm = site_map[std::string(function_name) + bb_name];
+				if(sm.contexts.empty())
+				{
+					sm.function_name = function_name;
+					sm.bb_name = bb_name;
+				}
+				size_t i;
+				for(i = 0; i < sm.contexts.size(); i++)
+					if(sm.contexts[i].bb_num == bb_num) break;
+				if(i == sm.contexts.size())
+				{
+					struct context_model cm;
+					cm.bb_num = bb_num;
+					sm.contexts.push_back(cm);
+				}
+				sm.contexts[i].digest.merge(digest);
+				fields = -1;
+			}
+			fields++;
+		}
+		free(line);
+		fclose(dfile);
+		return;
+	}
+
+	//build and save to file, written aside and renamed like ./ttracedata.txt
+	char tdtemp1[320];
+	sprintf(tdtemp1, "%s.%d", tdtemp, getpid());
+	FILE *file = fopen(tdtemp1, "w");
+	for(llvm::StringMap<struct site_model>::iterator sit = site_map.begin(); sit != site_map.end(); sit++)
+	{
+		struct site_model &sm = sit->getValue();
+		for(std::vector<struct context_model>::iterator cit = sm.contexts.begin(); cit != sm.contexts.end(); cit++)
+		{
+			for(std::vector<unsigned long>::iterator myit = cit->samples.begin(); myit != cit->samples.end(); myit++)
+				cit->digest.add(*myit, 1);
+			cit->digest.compress();
+			fprintf(file, "%s\n%s\n%d\n%d\n%lf\n%lf\n", sm.function_name.c_str(), sm.bb_name.c_str(), cit->bb_num,
+				(int)cit->digest.mean.size(), cit->digest.min, cit->digest.max);
+			for(size_t i = 0; i < cit->digest.mean.size(); i++)
+				fprintf(file, "%lf %lf\n", cit->digest.mean[i], cit->digest.weight[i]);
+		}
+	}
+	fclose(file);
+	rename(tdtemp1, tdtemp);
+}
+
+
+/**
+	emitDetectCall Function
+	--call instrument_function_detect with the constant table of a type2 site, any number of contexts
+	--b_vector and c_vector hold the bounds for sm.contexts in the same order
+	--table: contexts sorted with their bounds, and the site id, or open addressed by siteHash with 2^hash_bits slots above
+	  TE_TABLE_LINEAR contexts, see struct te_site in detect.c
+	--the runtime reads current_time, previous_time and pre_bb_num itself and restarts the interval when done
+*/
+void TimedExecution::emitDetectCall(IRBuilder<> &IRB, BasicBlock *BB, struct site_model &sm, std::vector<double> &b_vector, std::vector<double> &c_vector)
+{
+	Function *F = BB->getParent();
+	Module *M = F->getParent();
+	LLVMContext &llvm_context = M->getContext();
+	Type *I64Ty = Type::getInt64Ty(llvm_context);
+	Type *I8PtrTy = Type::getInt8PtrTy(llvm_context);
+	Value *instru_detect_f = M->getOrInsertFunction("instrument_function_detect", Type::getVoidTy(llvm_context), I8PtrTy, nullptr);
+
+	//sorted by context
+	size_t i, n = sm.contexts.size();
+	std::vector<std::pair<long, size_t> > order;
+	for(i = 0; i < n; i++)
+		order.push_back(std::make_pair((long)sm.contexts[i].bb_num, i));
+	std::sort(order.begin(), order.end());
+
+	int hash_bits = 0;
+	size_t slots = n;
+	if(n > TE_TABLE_LINEAR)
+	{
+		while((1UL << hash_bits) < 2 * n) hash_bits++;
+		slots = 1UL << hash_bits;
+	}
+	std::vector<uint64_t> ctx_table(slots, TE_TABLE_EMPTY), b_table(slots, 0), c_table(slots, 0);
+	for(i = 0; i < n; i++)
+	{
+		size_t slot = i;
+		if(hash_bits)
+			for(slot = siteHash(order[i].first, hash_bits); ctx_table[slot] != TE_TABLE_EMPTY; slot = (slot + 1) & (slots - 1));
+		ctx_table[slot] = order[i].first;
+		b_table[slot] = (long)b_vector[order[i].second];
+		c_table[slot] = (long)c_vector[order[i].second];
+	}
+
+	Constant *fields[] = {ConstantInt::get(I64Ty, n), ConstantInt::get(I64Ty, hash_bits),
+		createTableArg(ConstantDataArray::get(llvm_context, ctx_table), F, ".te_site_ctx"),
+		createTableArg(ConstantDataArray::get(llvm_context, b_table), F, ".te_site_b"),
+		createTableArg(ConstantDataArray::get(llvm_context, c_table), F, ".te_site_c"), siteId(BB)};
+	Constant *site = ConstantStruct::getAnon(llvm_context, fields);
+	GlobalVariable *site_gv = new GlobalVariable(*M, site->getType(), true, GlobalValue::PrivateLinkage, site, ".te_site");
+	IRB.CreateCall(instru_detect_f, ConstantExpr::getBitCast(site_gv, I8PtrTy));
+}
+
+
+/**
+	siteHash Function
+	--slot of a context in a table of 2^hash_bits slots, must match te_site_hash in detect.c
+*/
+size_t TimedExecution::siteHash(long ctx, int hash_bits)
+{
+	return ((uint64_t)ctx * 0x9E3779B97F4A7C15ULL) >> (64 - hash_bits);
+}
+
+
+/**
+	instrumentEcallExit Function
+	--insert a call right before the return of the ecall, the last basic block of p_entry_function
+*/
+void TimedExecution::instrumentEcallExit(Function *F, Value *callee, Value *arg)
+{
+	BasicBlock *BB = &(F->back());
+	BasicBlock::iterator BI, BE;
+	for(BI = BB->begin(), BE = BB->end(); BI != BE; BI++)
+	{
+		Instruction *II = BI;
+		if(isa<ReturnInst>(II)) break;
+	}
+
+	IRBuilder<> IRB1(BI == BE ? BB->getTerminator() : (Instruction *)BI);
+	IRB1.CreateCall(callee, arg);
+}
+
+
+/**
+	findContext Function
+	--the model of one context of a type2 site, NULL if the site or the context never showed up
+*/
+struct context_model *TimedExecution::findContext(llvm::StringMap<struct site_model> &site_map, StringRef key, int bb_num)
+{
+	llvm::StringMap<struct site_model>::iterator sit = site_map.find(key);
+	if(sit == site_map.end()) return NULL;
+	for(std::vector<struct context_model>::iterator cit = sit->getValue().contexts.begin(); cit != sit->getValue().contexts.end(); cit++)
+		if(cit->bb_num == bb_num) return &*cit;
+	return NULL;
+}
+
+
+/**
+	isType2Block Function
+	--same test as the instrumentation modes: more than one predecessor, a copy made by duplicateTails, the entry block or a return
+*/
+int TimedExecution::isType2Block(BasicBlock *BB)
+{
+	int num_pred = 0;
+	for(pred_iterator PI = pred_begin(BB), E = pred_end(BB); PI != E; PI++)
+		num_pred++;
+	int has_return_inst = 0;
+	for(BasicBlock::iterator BI = BB->begin(), BE = BB->end(); BI != BE; BI++)
+	{
+		Instruction *II = BI;
+		if(isa<ReturnInst>(II))
+			has_return_inst = 1;
+	}
+	return (num_pred > 1) || tail_copies.count(BB) || (strcmp(blockName(BB).c_str(), "entry") == 0) || has_return_inst;
+}
+
+
+/**
+	footprintClass Function
+	--memory footprint class of a basic block from its number of loads and stores
+	--0: none, 1: up to 4, 2: up to 16, 3: more
+*/
+int TimedExecution::footprintClass(BasicBlock *BB)
+{
+	int mem_count = 0;
+	for(BasicBlock::iterator BI = BB->begin(), BE = BB->end(); BI != BE; BI++)
+	{
+		Instruction *II = BI;
+		if(isa<LoadInst>(II) || isa<StoreInst>(II))
+			mem_count++;
+	}
+	if(mem_count == 0) return 0;
+	if(mem_count <= 4) return 1;
+	if(mem_count <= 16) return 2;
+	return 3;
+}
+
+
+/**
+	loadSiteFactors Function
+	--per site tfactor from ./tfactordata.txt (mode 18), keyed by function name + bb name, empty if there is none
+*/
+void TimedExecution::loadSiteFactors(char *currentd, llvm::StringMap<double> &factor_map)
+{
+	char tftemp[300];
+	strcpy(tftemp, currentd);
+	strcat(tftemp, "/tfactordata.txt");
+	FILE *ffile = fopen(tftemp, "r");
+	if(!ffile) return;
+
+	char *line = NULL;
+	size_t len = 0;
+	ssize_t read;
+	int count = 0;
+	std::string key;
+	while((read = getline(&line, &len, ffile)) != -1)
+	{
+		//leave out last character '\n'
+		line[read-1] = '\0';
+		if(count % 3 == 0) key = line;
+		else if(count % 3 == 1) key += line;
+		else factor_map[key] = atof(line);
+		count++;
+	}
+	free(line);
+	fclose(ffile);
+	errs() << "per site tfactor: " << factor_map.size() << " sites\n";
+}
+
+
+/**
+	splitHeldout Function
+	--splits trace_list into ecall runs and holds out every TE_HOLDOUT_RUNS-th run for calibration (mode 18),
+	  the last run with fewer runs, every TE_HOLDOUT_RUNS-th delta with a single run
+	--mode 9 rebuilds the same training part to apply the calibrated factors to the same c
+*/
+void TimedExecution::splitHeldout(std::vector<struct trace_info> &train_list, std::vector<struct trace_info> &heldout_list)
+{
+	//split in ecall runs, trace_list runs backwards in time
+	std::vector<int> run_vector(trace_list.size(), 0);
+	int runs = 0;
+	for(int i = (int)trace_list.size() - 1; i >= 0; i--)
+	{
+		if((strcmp(trace_list[i].function_name, p_entry_function) == 0) && (strcmp(trace_list[i].tail_type2_bb_name, "entry") == 0))
+			runs++;
+		run_vector[i] = runs;
+	}
+	errs() << "ecall runs: " << runs << "\n";
+	if(runs < 2)
+		errs() << "Timed Execution Calibration Warning: less than two ecall runs, holding out every " << TE_HOLDOUT_RUNS << "th delta instead.\n";
+
+	for(size_t i = 0; i < trace_list.size(); i++)
+	{
+		int heldout;
+		if(runs >= TE_HOLDOUT_RUNS) heldout = (run_vector[i] % TE_HOLDOUT_RUNS == 0);
+		else if(runs >= 2) heldout = (run_vector[i] == runs);
+		else heldout = (i % TE_HOLDOUT_RUNS == 0);
+		if(heldout) heldout_list.push_back(trace_list[i]);
+		else train_list.push_back(trace_list[i]);
+	}
+}
+
+/**
+	cusumMultiplier Function
+	--fixed point factor, TE_CUSUM_SCALE_BITS fraction bits, that scales one stdev to exactly 2^TE_CUSUM_FRACTION_BITS units
+	--stdevs below one tick count as one, so the product stays within 2^(TE_CUSUM_FRACTION_BITS + TE_CUSUM_SCALE_BITS) per tick
+*/
+long TimedExecution::cusumMultiplier(double stdev)
+{
+	return (long)round((1L << (TE_CUSUM_FRACTION_BITS + TE_CUSUM_SCALE_BITS)) / std::max(stdev, 1.0));
+}
+
+
+/**
+	fitMixture Function
+	--EM fit of a TE_MIXTURE_COMPONENTS gaussian mixture to samples, started from equal sized slices of the sorted samples
+	--components below TE_MIXTURE_MIN_WEIGHT are dropped, at least one is always returned
+*/
+void TimedExecution::fitMixture(std::vector<unsigned long> &samples, std::vector<double> &average_vector, std::vector<double> &stdev_vector, std::vector<double> &weight_vector)
+{
+	int k, K = TE_MIXTURE_COMPONENTS;
+	size_t i, n = samples.size();
+	if(n < (size_t)K * 2) K = 1;
+
+	std::vector<double> sorted(samples.begin(), samples.end());
+	std::sort(sorted.begin(), sorted.end());
+	std::vector<double> average(K), variance(K), weight(K);
+	for(k = 0; k < K; k++)
+	{
+		size_t begin = n * k / K, end = n * (k + 1) / K;
+		double sum = 0, square_sum = 0;
+		for(i = begin; i < end; i++) { sum += sorted[i]; square_sum += sorted[i] * sorted[i]; }
+		average[k] = sum / (end - begin);
+		variance[k] = std::max(1.0, square_sum / (end - begin) - average[k] * average[k]);
+		weight[k] = (double)(end - begin) / n;
+	}
+
+	std::vector<double> responsibility(n * K);
+	double last_likelihood = -HUGE_VAL;
+	for(int iteration = 0; iteration < TE_MIXTURE_ITERATIONS && K > 1; iteration++)
+	{
+		//e step
+		double likelihood = 0;
+		for(i = 0; i < n; i++)
+		{
+			double total = 0;
+			for(k = 0; k < K; k++)
+			{
+				double d = sorted[i] - average[k];
+				responsibility[i * K + k] = weight[k] * exp(-d * d / (2 * variance[k])) / sqrt(variance[k]);
+				total += responsibility[i * K + k];
+			}
+			//far from every component, give it to the nearest one
+			if(total == 0)
+			{
+				int nearest = 0;
+				for(k = 1; k < K; k++)
+					if(fabs(sorted[i] - average[k]) < fabs(sorted[i] - average[nearest])) nearest = k;
+				responsibility[i * K + nearest] = total = 1;
+			}
+			for(k = 0; k < K; k++) responsibility[i * K + k] /= total;
+			likelihood += log(total);
+		}
+
+		//m step
+		for(k = 0; k < K; k++)
+		{
+			double r = 0, sum = 0, square_sum = 0;
+			for(i = 0; i < n; i++)
+			{
+				r += responsibility[i * K + k];
+				sum += responsibility[i * K + k] * sorted[i];
+			}
+			if(r == 0) { weight[k] = 0; continue; }
+			average[k] = sum / r;
+			for(i = 0; i < n; i++)
+				square_sum += responsibility[i * K + k] * (sorted[i] - average[k]) * (sorted[i] - average[k]);
+			variance[k] = std::max(1.0, square_sum / r);
+			weight[k] = r / n;
+		}
+
+		if(fabs(likelihood - last_likelihood) < 1e-6 * fabs(likelihood)) break;
+		last_likelihood = likelihood;
+	}
+
+	average_vector.clear(); stdev_vector.clear(); weight_vector.clear();
+	int heaviest = 0;
+	for(k = 0; k < K; k++)
+	{
+		if(weight[k] > weight[heaviest]) heaviest = k;
+		if(weight[k] < TE_MIXTURE_MIN_WEIGHT) continue;
+		average_vector.push_back(average[k]);
+		stdev_vector.push_back(sqrt(variance[k]));
+		weight_vector.push_back(weight[k]);
+	}
+	if(average_vector.empty())
+	{
+		average_vector.push_back(average[heaviest]);
+		stdev_vector.push_back(sqrt(variance[heaviest]));
+		weight_vector.push_back(weight[heaviest]);
+	}
+}
+
+/**
+	instructionCost Function
+	--rough latency of an instruction in cycles, -1 when it cannot be bounded statically
+	--the pass runs without a target machine, so a fixed table stands in for the target cost model
+*/
+int TimedExecution::instructionCost(Instruction *I)
+{
+	if(isa<PHINode>(I) || isa<GetElementPtrInst>(I) || isa<CastInst>(I) || isa<AllocaInst>(I))
+		return 0;
+	if(isa<LoadInst>(I))
+		return 4;
+	if(CallInst *CI = dyn_cast<CallInst>(I))
+	{
+		Function *callee = CI->getCalledFunction();
+		//intrinsics are expanded inline, memcpy and friends are bounded by their length only
+		if(callee && callee->isIntrinsic())
+			return isa<MemIntrinsic>(CI) ? -1 : 1;
+		//the callee has type2 sites of its own from its entry on, only the call itself counts here
+		if(callee && !callee->isDeclaration())
+			return 5;
+		//library code, ocalls and indirect calls
+		return -1;
+	}
+	switch(I->getOpcode())
+	{
+		case Instruction::Mul:
+		case Instruction::FAdd:
+		case Instruction::FSub:
+		case Instruction::FMul:
+			return 4;
+		case Instruction::UDiv:
+		case Instruction::SDiv:
+		case Instruction::URem:
+		case Instruction::SRem:
+		case Instruction::FDiv:
+		case Instruction::FRem:
+			return 25;
+		default:
+			return 1;
+	}
+}
+
+
+/**
+	intervalCost Function
+	--static cost of the interval a type2 site measures: the block itself and the chain of single
+	  predecessor blocks up to the previous type2 block, -1 when any of them cannot be bounded
+	--loop headers have several predecessors and are type2, so an interval never spans a loop iteration
+*/
+long TimedExecution::intervalCost(BasicBlock *BB)
+{
+	long cost = 0;
+	BasicBlock *CB = BB;
+	do
+	{
+		for(BasicBlock::iterator BI = CB->begin(), BE = CB->end(); BI != BE; BI++)
+		{
+			int c = instructionCost(BI);
+			if(c < 0) return -1;
+			cost += c;
+		}
+		CB = CB->getSinglePredecessor();
+	} while(CB && CB != BB && !isType2Block(CB));
+	return cost;
+}
+
+
+/**
+	estimateStaticSites Function
+	--static upper bound for every type2 block without a trained model, keyed by function name + bb name
+	--cycles are turned into ticks with the 90th percentile ratio of trained average to static cost,
+	  times TE_STATIC_MARGIN, plus page_fault_average
+	--call it before instrumenting, the report goes to ./tstaticdata.txt : each entry: function name,
+	  basic block name, static cost, bound (-1 for unbounded, left unchecked)
+*/
+void TimedExecution::estimateStaticSites(Module &M, char *currentd, llvm::StringMap<struct site_model> &site_map, llvm::StringMap<double> &static_map)
+{
+	std::vector<double> ratio_vector;
+	std::vector<BasicBlock *> untrained_vector;
+	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
+	{
+		//runtime bodies linked in by linkRuntime are not sites
+		if(MI->isDeclaration() || MI->hasAvailableExternallyLinkage()) continue;
+		for(Function::iterator FI = MI->begin(), FE = MI->end(); FI != FE; FI++)
+		{
+			BasicBlock *BB = FI;
+			if(!isType2Block(BB)) continue;
+			llvm::StringMap<struct site_model>::iterator sit = site_map.find(MI->getName().str() + blockName(BB));
+			if(sit == site_map.end())
+			{
+				untrained_vector.push_back(BB);
+				continue;
+			}
+			long cost = intervalCost(BB);
+			if(cost <= 0) continue;
+			for(std::vector<struct context_model>::iterator cit = sit->getValue().contexts.begin(); cit != sit->getValue().contexts.end(); cit++)
+				ratio_vector.push_back(cit->average / cost);
+		}
+	}
+	if(ratio_vector.empty())
+	{
+		errs() << "Timed Execution Static Estimate Warning: no trained site to calibrate against, " << untrained_vector.size() << " untrained sites left unchecked.\n";
+		return;
+	}
+	std::sort(ratio_vector.begin(), ratio_vector.end());
+	double ticks_per_cycle = ratio_vector[ratio_vector.size() * 9 / 10];
+
+	char tstemp[300], tstemp1[320];
+	strcpy(tstemp, currentd);
+	strcat(tstemp, "/tstaticdata.txt");
+	sprintf(tstemp1, "%s.%d", tstemp, getpid());
+	FILE *sfile = fopen(tstemp1, "w");
+	int unbounded = 0;
+	for(std::vector<BasicBlock *>::iterator it = untrained_vector.begin(); it != untrained_vector.end(); it++)
+	{
+		BasicBlock *BB = *it;
+		std::string function_name = BB->getParent()->getName().str();
+		long cost = intervalCost(BB);
+		double bound = -1;
+		if(cost >= 0)
+		{
+			bound = cost * ticks_per_cycle * TE_STATIC_MARGIN + page_fault_average;
+			static_map[function_name + blockName(BB)] = bound;
+		}
+		else unbounded++;
+		fprintf(sfile, "%s\n%s\n%ld\n%lf\n", function_name.c_str(), blockName(BB).c_str(), cost, bound);
+	}
+	fclose(sfile);
+	rename(tstemp1, tstemp);
+	errs() << "static estimate: ticks per cycle: " << ticks_per_cycle << ", static sites: " << static_map.size() << ", unbounded: " << unbounded << "\n";
+}
+
+
+/**
+	instrumentStaticSites Function
+	--coarse check for the sites estimateStaticSites bounded: delta above the static bound calls
+	  instrument_function_report_anomaly with context -1, which marks the bound as static
+*/
+void TimedExecution::instrumentStaticSites(Module &M, llvm::StringMap<double> &static_map)
+{
+	if(static_map.empty()) return;
+	Type *I64Ty = Type::getInt64Ty(M.getContext());
+	Type *I8PtrTy = Type::getInt8PtrTy(M.getContext());
+	Value *instru_report_anomaly_f = M.getOrInsertFunction("instrument_function_report_anomaly", Type::getVoidTy(M.getContext()), I64Ty, I64Ty, Type::getInt32Ty(M.getContext()), nullptr);
+	GlobalVariable *gv;
+	LoadInst *load;
+
+	//blocks are split below, collect them first
+	std::vector<BasicBlock *> bb_vector;
+	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
+	{
+		if(MI->isDeclaration() || MI->hasAvailableExternallyLinkage()) continue;
+		for(Function::iterator FI = MI->begin(), FE = MI->end(); FI != FE; FI++)
+			if(static_map.count(MI->getName().str() + blockName(FI)))
+				bb_vector.push_back(FI);
+	}
+
+	for(std::vector<BasicBlock *>::iterator bit = bb_vector.begin(); bit != bb_vector.end(); bit++)
+	{
+		BasicBlock *BB = *bit;
+		Function *F = BB->getParent();
+		double bound = static_map[F->getName().str() + blockName(BB)];
+		Instruction *tail_begin = BB->getTerminator();
+
+		IRBuilder<> IRB1(tail_begin);
+		gv = M.getGlobalVariable(StringRef("current_time"), true);
+		load = IRB1.CreateLoad(gv);
+		gv = M.getGlobalVariable(StringRef("previous_time"), true);
+		LoadInst *last_time_load = IRB1.CreateLoad(gv);
+		IRB1.CreateStore(load, gv);
+		Value *delta = IRB1.CreateSub(load, last_time_load);
+		Value *over = IRB1.CreateICmpUGT(delta, ConstantInt::get(I64Ty, (long)bound, true));
+
+		TerminatorInst *report_term = SplitBlockAndInsertIfThen(over, tail_begin, false);
+		IRBuilder<> IRB2(report_term);
+		Value *args[] = {ConstantInt::get(I64Ty, -1, true), delta, siteId(BB)};
+		IRB2.CreateCall(instru_report_anomaly_f, args);
+
+		//get time again after the check
+		IRBuilder<> IRB3(tail_begin);
+		gv = M.getGlobalVariable(StringRef("current_time"), true);
+		load = IRB3.CreateLoad(gv);
+		gv = M.getGlobalVariable(StringRef("previous_time"), true);
+		IRB3.CreateStore(load, gv);
+	}
+}
+
+/**
+	loadClockFit Function
+	--least squares fit of ticks against cycles from ./tclockdata.txt, returns 0 if there is no usable fit
+	--clock_error: largest residual plus the cycles window of the sample, in ticks
+*/
+int TimedExecution::loadClockFit(char *currentd, double &slope, double &clock_error)
+{
+	char tctemp[300];
+	strcpy(tctemp, currentd);
+	strcat(tctemp, "/tclockdata.txt");
+	FILE *cfile = fopen(tctemp, "r");
+	if(!cfile) return 0;
+
+	std::vector<double> cycles_vector, ticks_vector, width_vector;
+	char *line = NULL;
+	size_t len = 0;
+	ssize_t read;
+	int count = 0;
+	while((read = getline(&line, &len, cfile)) != -1)
+	{
+		if(count % 3 == 0) cycles_vector.push_back(atof(line));
+		else if(count % 3 == 1) ticks_vector.push_back(atof(line));
+		else width_vector.push_back(atof(line));
+		count++;
+	}
+	free(line);
+	fclose(cfile);
+
+	size_t i, n = width_vector.size();
+	if(n < 2) return 0;
+	//relative to the first sample, the raw counters are too large for the squares
+	double cycles_mean = 0, ticks_mean = 0;
+	//backwards, the first sample is the origin
+	for(int j = n - 1; j >= 0; j--)
+	{
+		cycles_vector[j] -= cycles_vector[0];
+		ticks_vector[j] -= ticks_vector[0];
+		cycles_mean += cycles_vector[j];
+		ticks_mean += ticks_vector[j];
+	}
+	cycles_mean /= n; ticks_mean /= n;
+	double sxy = 0, sxx = 0;
+	for(i = 0; i < n; i++)
+	{
+		sxy += (cycles_vector[i] - cycles_mean) * (ticks_vector[i] - ticks_mean);
+		sxx += (cycles_vector[i] - cycles_mean) * (cycles_vector[i] - cycles_mean);
+	}
+	if(sxx == 0) return 0;
+	slope = sxy / sxx;
+	double intercept = ticks_mean - slope * cycles_mean;
+
+	double residual = 0, width = 0;
+	for(i = 0; i < n; i++)
+	{
+		residual = std::max(residual, fabs(ticks_vector[i] - intercept - slope * cycles_vector[i]));
+		width = std::max(width, width_vector[i]);
+	}
+	clock_error = residual + slope * width;
+	errs() << "clock fit: " << n << " samples, ticks per cycle: " << slope << ", error: " << clock_error << " ticks\n";
+	return 1;
+}
+
+/**
+	compactShift Function
+	--smallest shift that brings c_max into bits bits, rounding up
+*/
+int TimedExecution::compactShift(double c_max, int bits)
+{
+	int shift = 0;
+	while(((unsigned long)ceil(c_max) + (1UL << shift) - 1) >> shift >= (1UL << bits))
+		shift++;
+	return shift;
+}
+
+/**
+	lowerBound Function
+	--b of a context, max(0, average - TE_LOWER_SIGMAS * stdev)
+	--a delta below the average hides no exit, b only catches broken clocks and skipped code, one stdev below
+	  as in mode 12 would flag about 1 in 6 normal deltas
+*/
+double TimedExecution::lowerBound(double average, double stdev)
+{
+	return std::max(0.0, average - TE_LOWER_SIGMAS * stdev);
+}
+
+/**
+	pruneSiteModels Function
+	--drops contexts whose check is worth less than prune_threshold (line 12 of tconfig.txt), and sites left without any
+	--confidence: 1 - 1 / sqrt(samples), usefulness: 1 - stdev / average, score: their product, 0 if either is negative
+	--a context with a digest of more weight than its samples (merged training runs) is scored from the digest
+	--so a single sample (stdev 0, bounds of zero width) and a stdev above the average (bounds never hit) both score 0
+	--sites left without contexts go to reset_map, they still have to restart the interval (instrumentTimeReset)
+	--then the overhead budget, if set, picks which of the remaining sites get checked (budgetSiteModels)
+	--the pruned contexts go to ./tprunedata.txt (prune_name) : each entry: function name, basic block name, prior bb num,
+	  samples, average, stdev, score
+*/
+void TimedExecution::pruneSiteModels(char *currentd, llvm::StringMap<struct site_model> &site_map, llvm::StringMap<int> &reset_map,
+				const char *prune_name, const char *budget_name)
+{
+	char tptemp[300], tptemp1[320];
+	strcpy(tptemp, currentd);
+	strcat(tptemp, prune_name);
+	sprintf(tptemp1, "%s.%d", tptemp, getpid());
+	FILE *pfile = fopen(tptemp1, "w");
+
+	int pruned = 0, kept = 0;
+	double total_ticks = 0;
+	//executions of every site before pruning, for budgetSiteModels
+	llvm::StringMap<double> execution_map;
+	std::vector<std::string> empty_vector;
+	for(llvm::StringMap<struct site_model>::iterator sit = site_map.begin(); sit != site_map.end(); sit++)
+	{
+		struct site_model &sm = sit->getValue();
+		std::vector<struct context_model> kept_vector;
+		for(std::vector<struct context_model>::iterator cit = sm.contexts.begin(); cit != sm.contexts.end(); cit++)
+		{
+			//contexts merged from the digests of other training runs (buildSiteDigests) count all their runs
+			double n = cit->samples.size();
+			if(cit->digest.total > n)
+			{
+				n = cit->digest.total;
+				cit->digest.moments(cit->average, cit->stdev);
+			}
+			total_ticks += cit->average * n;
+			execution_map[sit->getKey()] += n;
+			double confidence = n > 0 ? 1 - 1 / sqrt(n) : 0;
+			double usefulness = cit->average > 0 ? 1 - cit->stdev / cit->average : 0;
+			double score = std::max(0.0, confidence) * std::max(0.0, usefulness);
+			if(score >= prune_threshold)
+			{
+				kept_vector.push_back(*cit);
+				continue;
+			}
+			fprintf(pfile, "%s\n%s\n%d\n%lu\n%lf\n%lf\n%lf\n", sm.function_name.c_str(), sm.bb_name.c_str(), cit->bb_num,
+				(unsigned long)n, cit->average, cit->stdev, score);
+			pruned++;
+		}
+		kept += kept_vector.size();
+		sm.contexts.swap(kept_vector);
+		if(sm.contexts.empty())
+		{
+			empty_vector.push_back(sit->getKey().str());
+			reset_map[sit->getKey()] = 1;
+		}
+	}
+	for(std::vector<std::string>::iterator it = empty_vector.begin(); it != empty_vector.end(); it++)
+		site_map.erase(*it);
+
+	fclose(pfile);
+	rename(tptemp1, tptemp);
+	errs() << "prune threshold: " << prune_threshold << ", pruned contexts: " << pruned << ", kept: " << kept
+		<< ", sites left unchecked: " << empty_vector.size() << "\n";
+
+	if(overhead_budget > 0)
+		budgetSiteModels(currentd, site_map, reset_map, execution_map, total_ticks, budget_name);
+}
+
+/**
+	instrumentTimeReset Function
+	--restart the interval at the end of the blocks in reset_map, sites without a check that still split the trace
+*/
+void TimedExecution::instrumentTimeReset(Module &M, llvm::StringMap<int> &reset_map)
+{
+	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
+	{
+		if(MI->isDeclaration() || MI->hasAvailableExternallyLinkage()) continue;
+		for(Function::iterator FI = MI->begin(), FE = MI->end(); FI != FE; FI++)
+		{
+			if(!reset_map.count(MI->getName().str() + blockName(FI))) continue;
+			IRBuilder<> IRB(FI->getTerminator());
+			LoadInst *load = IRB.CreateLoad(M.getGlobalVariable(StringRef("current_time"), true));
+			IRB.CreateStore(load, M.getGlobalVariable(StringRef("previous_time"), true));
+		}
+	}
+}
+
+/**
+	beginCheckTiming Function
+	--get_time before a check when line 13 of tconfig.txt asks for it, NULL otherwise
+*/
+Value *TimedExecution::beginCheckTiming(IRBuilder<> &IRB)
+{
+	if(!measure_checks) return NULL;
+	Module *M = IRB.GetInsertBlock()->getParent()->getParent();
+	Type *I64Ty = Type::getInt64Ty(M->getContext());
+	Value *get_time_f = M->getOrInsertFunction("get_time", I64Ty, I64Ty, nullptr);
+	return IRB.CreateCall(get_time_f, ConstantInt::get(I64Ty, 0));
+}
+
+
+/**
+	endCheckTiming Function
+	--adds the cycles since beginCheckTiming to te_check_cycles and counts the check in te_check_count (detect.c)
+*/
+void TimedExecution::endCheckTiming(IRBuilder<> &IRB, Value *begin)
+{
+	if(begin == NULL) return;
+	Module *M = IRB.GetInsertBlock()->getParent()->getParent();
+	Type *I64Ty = Type::getInt64Ty(M->getContext());
+	Value *get_time_f = M->getOrInsertFunction("get_time", I64Ty, I64Ty, nullptr);
+	Value *end = IRB.CreateCall(get_time_f, ConstantInt::get(I64Ty, 0));
+
+	const char *names[] = {"te_check_cycles", "te_check_count"};
+	Value *increments[] = {IRB.CreateSub(end, begin), ConstantInt::get(I64Ty, 1)};
+	for(int i = 0; i < 2; i++)
+	{
+		GlobalVariable *gv = M->getGlobalVariable(StringRef(names[i]), true);
+		if(gv == NULL)
+		{
+			gv = new GlobalVariable(*M, I64Ty, false, GlobalValue::AvailableExternallyLinkage, 0, names[i]);
+			gv->setInitializer(ConstantInt::get(I64Ty, 0));
+		}
+		IRB.CreateStore(IRB.CreateAdd(IRB.CreateLoad(gv), increments[i]), gv);
+	}
+}
+
+/**
+	linkRuntime Function
+	--links the detection runtime compiled to bitcode (line 14 of tconfig.txt, relative to the tconfig.txt directory
+	  unless absolute) into the module, so the optimizer sees the bodies of the instrument_function_* calls
+	--every definition taken from it becomes available_externally: inlined and specialized where it is called,
+	  but the symbols still come from the runtime object the enclave links, so state like the anormaly counters stays single
+	--the check fast paths are marked alwaysinline, the always inliner of the normal pipeline folds their tables in
+*/
+void TimedExecution::linkRuntime(Module &M, char *currentd)
+{
+	char rtemp[450];
+	if(p_runtime_file[0] == '/') strcpy(rtemp, p_runtime_file);
+	else
+	{
+		strcpy(rtemp, currentd);
+		strcat(rtemp, "/");
+		strcat(rtemp, p_runtime_file);
+	}
+
+	SMDiagnostic err;
+	std::unique_ptr<Module> runtime = parseIRFile(rtemp, err, M.getContext());
+	if(!runtime)
+	{
+		errs() << "Timed Execution Configration Error: cannot read runtime bitcode " << rtemp << ": " << err.getMessage() << "\n";
+		exit(-1);
+	}
+
+	std::vector<std::string> function_vector, global_vector;
+	for(Module::iterator FI = runtime->begin(), FE = runtime->end(); FI != FE; FI++)
+		if(!FI->isDeclaration() && !FI->hasLocalLinkage()) function_vector.push_back(FI->getName().str());
+	for(Module::global_iterator GI = runtime->global_begin(), GE = runtime->global_end(); GI != GE; GI++)
+		//llvm.global.annotations stays appending, eliminateTimeRedundancy reads it
+		if(!GI->isDeclaration() && !GI->hasLocalLinkage() && !GI->getName().startswith("llvm.")) global_vector.push_back(GI->getName().str());
+
+	if(Linker::LinkModules(&M, runtime.get()))
+	{
+		errs() << "Timed Execution Configration Error: cannot link runtime bitcode " << rtemp << "\n";
+		exit(-1);
+	}
+
+	const char *fast_paths[] = {"instrument_function_detect", "instrument_function_detect_compact8", "instrument_function_detect_compact16",
+		"instrument_function_detect_table", "instrument_function_detect_histogram", "instrument_function_inject_fault", NULL};
+	for(std::vector<std::string>::iterator it = function_vector.begin(); it != function_vector.end(); it++)
+	{
+		Function *F = M.getFunction(*it);
+		if(F == NULL || F->isDeclaration()) continue;
+		F->setLinkage(GlobalValue::AvailableExternallyLinkage);
+		for(int i = 0; fast_paths[i]; i++)
+			if(*it == fast_paths[i]) F->addFnAttr(Attribute::AlwaysInline);
+	}
+	for(std::vector<std::string>::iterator it = global_vector.begin(); it != global_vector.end(); it++)
+	{
+		GlobalVariable *GV = M.getGlobalVariable(*it, true);
+		if(GV && !GV->isDeclaration()) GV->setLinkage(GlobalValue::AvailableExternallyLinkage);
+	}
+	errs() << "runtime: " << rtemp << ", " << function_vector.size() << " functions, " << global_vector.size() << " globals\n";
+}
+
+/**
+	loadSiteSymbols Function
+	--reads the site ids every module compiled before handed out from ./tsymdata.txt, so ids stay dense and the same
+	  block keeps its number in every translation unit, new sites are numbered on from the largest
+*/
+void TimedExecution::loadSiteSymbols(char *currentd)
+{
+	site_table.clear();
+	site_symbols.clear();
+	site_table_next = 0;
+	char tstemp[300];
+	strcpy(tstemp, currentd);
+	strcat(tstemp, "/tsymdata.txt");
+	std::vector<std::vector<std::string> > records;
+	readRecords(tstemp, 5, records);
+	for(std::vector<std::vector<std::string> >::iterator it = records.begin(); it != records.end(); it++)
+	{
+		int id = atoi((*it)[0].c_str());
+		site_table[(*it)[4] + "\n" + (*it)[1] + "\n" + (*it)[2]] = id;
+		site_table_next = std::max(site_table_next, id + 1);
+	}
+}
+
+/**
+	siteKeyId Function
+	--dense id of the site function_name, bb_name: the one in ./tsymdata.txt, or the next free one for a new site,
+	  which writeSiteSymbols appends
+	--module: identifier of the module for static functions, whose names repeat across translation units, empty otherwise
+*/
+int TimedExecution::siteKeyId(const std::string &function_name, const std::string &bb_name, const std::string &module)
+{
+	std::string key = module + "\n" + function_name + "\n" + bb_name;
+	llvm::StringMap<int>::iterator it = site_table.find(key);
+	if(it != site_table.end()) return it->getValue();
+
+	struct site_symbol symbol;
+	symbol.id = site_table_next++;
+	symbol.function_name = function_name;
+	symbol.bb_name = bb_name;
+	symbol.location = "?";
+	symbol.module = module;
+	site_table[key] = symbol.id;
+	site_symbols.push_back(symbol);
+	return symbol.id;
+}
+
+/**
+	siteId Function
+	--dense 32 bit id of a checked block, the runtime gets it instead of the function and bb name strings, see siteKeyId
+	--names and the first debug location of the block go to ./tsymdata.txt (writeSiteSymbols)
+*/
+Constant *TimedExecution::siteId(BasicBlock *BB)
+{
+	Type *I32Ty = Type::getInt32Ty(BB->getContext());
+	std::map<BasicBlock *, int>::iterator it = site_ids.find(BB);
+	if(it != site_ids.end()) return ConstantInt::get(I32Ty, it->second);
+
+	Function *F = BB->getParent();
+	size_t known = site_symbols.size();
+	int id = siteKeyId(F->getName().str(), blockName(BB), F->hasLocalLinkage() ? F->getParent()->getModuleIdentifier() : "");
+	site_ids[BB] = id;
+
+	//a new site: its first debug location
+	if(site_symbols.size() > known)
+		for(BasicBlock::iterator BI = BB->begin(), BE = BB->end(); BI != BE; BI++)
+		{
+			DebugLoc DL = BI->getDebugLoc();
+			if(DL.isUnknown()) continue;
+			DIScope scope(DL.getScope(BB->getContext()));
+			site_symbols.back().location = scope.getFilename().str() + ":" + std::to_string(DL.getLine());
+			break;
+		}
+	return ConstantInt::get(I32Ty, id);
+}
+
+
+/**
+	writeSiteSymbols Function
+	--./tsymdata.txt : each entry: site id, function name, basic block name, file:line or ? without debug info,
+	  module for static functions or an empty line
+	--appends the sites this module numbered to the entries of the modules compiled before
+	--an id taken by another site in the meantime (modules compiled in parallel) fails the build, the runtime could not
+	  tell the two apart, compile the modules of one enclave one after the other
+*/
+void TimedExecution::writeSiteSymbols(char *currentd)
+{
+	if(site_symbols.empty()) return;
+	char tstemp[300], tstemp1[320];
+	strcpy(tstemp, currentd);
+	strcat(tstemp, "/tsymdata.txt");
+
+	//read again, another compile may have written it since loadSiteSymbols
+	std::vector<std::vector<std::string> > records;
+	readRecords(tstemp, 5, records);
+	std::map<int, std::string> id_map;
+	for(std::vector<std::vector<std::string> >::iterator it = records.begin(); it != records.end(); it++)
+		id_map[atoi((*it)[0].c_str())] = (*it)[4] + "\n" + (*it)[1] + "\n" + (*it)[2];
+	for(std::vector<struct site_symbol>::iterator it = site_symbols.begin(); it != site_symbols.end(); it++)
+	{
+		std::map<int, std::string>::iterator mit = id_map.find(it->id);
+		if(mit != id_map.end() && mit->second != it->module + "\n" + it->function_name + "\n" + it->bb_name)
+		{
+			errs() << "Timed Execution Configration Error: site id " << it->id << " given to " << it->function_name << " "
+				<< it->bb_name << " was taken by another module compiled at the same time.\n";
+			exit(-1);
+		}
+	}
+
+	sprintf(tstemp1, "%s.%d", tstemp, getpid());
+	FILE *sfile = fopen(tstemp1, "w");
+	for(std::vector<std::vector<std::string> >::iterator it = records.begin(); it != records.end(); it++)
+		fprintf(sfile, "%s\n%s\n%s\n%s\n%s\n", (*it)[0].c_str(), (*it)[1].c_str(), (*it)[2].c_str(), (*it)[3].c_str(), (*it)[4].c_str());
+	for(std::vector<struct site_symbol>::iterator it = site_symbols.begin(); it != site_symbols.end(); it++)
+		if(!id_map.count(it->id))
+			fprintf(sfile, "%d\n%s\n%s\n%s\n%s\n", it->id, it->function_name.c_str(), it->bb_name.c_str(), it->location.c_str(),
+				it->module.c_str());
+	fclose(sfile);
+	rename(tstemp1, tstemp);
+	errs() << "site ids: " << site_table_next << ", new in this module: " << site_symbols.size()
+		<< ", strings: " << string_cache.size() << "\n";
+}
+
+/**
+	localizeContext Function
+	--keeps pre_bb_num in SSA inside every function that uses it: its loads and stores go to a local slot that
+	  mem2reg turns into phi nodes, so type1 blocks no longer store to memory on every edge
+	--the global is only written before calls and returns, where the context crosses into another function,
+	  and read back at entry and after calls to anything that is not part of the runtime
+	--runtime calls that get the context as an argument (detect1..4, the histogram, compact and table checks,
+	  report_anomaly and their te_cold_ wrappers) do not need the global and get no store, instrument_function_detect
+	  reads the global itself and keeps it, as does every call the pass does not know
+*/
+void TimedExecution::localizeContext(Module &M)
+{
+	GlobalVariable *ctx_gv = M.getGlobalVariable(StringRef("pre_bb_num"), true);
+	if(ctx_gv == NULL) return;
+	int functions = 0, stores = 0, skipped = 0;
+
+	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
+	{
+		Function *F = MI;
+		//runtime bodies linked in by linkRuntime read the global on purpose
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
+
+		std::vector<Instruction *> access_vector, call_vector;
+		for(Function::iterator FI = F->begin(), FE = F->end(); FI != FE; FI++)
+			for(BasicBlock::iterator BI = FI->begin(), BE = FI->end(); BI != BE; BI++)
+			{
+				Instruction *II = BI;
+				if(LoadInst *LI = dyn_cast<LoadInst>(II))
+				{
+					if(LI->getPointerOperand() == ctx_gv) access_vector.push_back(II);
 				}
-				else if(vector_size == 4)
+				else if(StoreInst *SI = dyn_cast<StoreInst>(II))
 				{
-					Constant *myit_value_int = ConstantInt::get(I64Ty, *myit);
-					Constant *mybit_value_int = ConstantInt::get(I64Ty, *mybit);
-					Constant *mycit_value_int = ConstantInt::get(I64Ty, *mycit);
-					Constant *myit1_value_int = ConstantInt::get(I64Ty, *(myit+1));
-					Constant *mybit1_value_int = ConstantInt::get(I64Ty, *(mybit+1));
-					Constant *mycit1_value_int = ConstantInt::get(I64Ty, *(mycit+1));
-					Constant *myit2_value_int = ConstantInt::get(I64Ty, *(myit+2));
-					Constant *mybit2_value_int = ConstantInt::get(I64Ty, *(mybit+2));
-					Constant *mycit2_value_int = ConstantInt::get(I64Ty, *(mycit+2));
-					Constant *myit3_value_int = ConstantInt::get(I64Ty, *(myit+3));
-					Constant *mybit3_value_int = ConstantInt::get(I64Ty, *(mybit+3));
-					Constant *mycit3_value_int = ConstantInt::get(I64Ty, *(mycit+3));
-					Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-					Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
-					Value *args[] = {load, detect_result_sub_inst, last_time_load, curr, myit_value_int, mybit_value_int, mycit_value_int,
-								myit1_value_int, mybit1_value_int, mycit1_value_int,
-								myit2_value_int, mybit2_value_int, mycit2_value_int,
-								myit3_value_int, mybit3_value_int, mycit3_value_int, str_para1, str_para2};
-					//IRBuilder<> IRB(newBB2->getTerminator());
-					IRBuilder<> IRB(BB->getTerminator());
-					IRB.CreateCall(instru_detect4_f, args);
-				}*/
+					if(SI->getPointerOperand() == ctx_gv) access_vector.push_back(II);
+				}
+				else if(CallInst *CI = dyn_cast<CallInst>(II))
+				{
+					if(!isa<IntrinsicInst>(CI) && !CI->isInlineAsm()) call_vector.push_back(II);
+				}
+				else if(isa<ReturnInst>(II)) call_vector.push_back(II);
+			}
+		if(access_vector.empty()) continue;
+
+		IRBuilder<> IRB(F->getEntryBlock().getFirstInsertionPt());
+		AllocaInst *slot = IRB.CreateAlloca(ctx_gv->getType()->getElementType(), nullptr, "te_ctx");
+		IRB.CreateStore(IRB.CreateLoad(ctx_gv), slot);
+		for(std::vector<Instruction *>::iterator it = access_vector.begin(); it != access_vector.end(); it++)
+		{
+			if(isa<LoadInst>(*it)) (*it)->setOperand(0, slot);
+			else (*it)->setOperand(1, slot);
+		}
+
+		for(std::vector<Instruction *>::iterator it = call_vector.begin(); it != call_vector.end(); it++)
+		{
+			Function *callee = isa<CallInst>(*it) ? cast<CallInst>(*it)->getCalledFunction() : NULL;
+			bool runtime = callee && (callee->getName().startswith("instrument_function_") || callee->getName().startswith("te_cold_"));
+			bool ctx_arg = false;
+			for(unsigned i = 0; runtime && i < cast<CallInst>(*it)->getNumArgOperands(); i++)
+			{
+				LoadInst *LI = dyn_cast<LoadInst>(cast<CallInst>(*it)->getArgOperand(i));
+				if(LI && LI->getPointerOperand() == slot) ctx_arg = true;
+			}
+			if(ctx_arg) skipped++;
+			else
+			{
+				IRBuilder<> IRB1(*it);
+				IRB1.CreateStore(IRB1.CreateLoad(slot), ctx_gv);
+				stores++;
+			}
+			if(isa<ReturnInst>(*it)) continue;
+
+			//the runtime reads the context but never sets it
+			if(runtime) continue;
+			BasicBlock::iterator next = *it;
+			next++;
+			IRBuilder<> IRB2(next);
+			IRB2.CreateStore(IRB2.CreateLoad(ctx_gv), slot);
+		}
+
+		DominatorTree DT;
+		DT.recalculate(*F);
+		AllocaInst *slots[] = {slot};
+		PromoteMemToReg(slots, DT);
+		functions++;
+	}
+	errs() << "context in SSA: " << functions << " functions, stores at calls and returns: " << stores
+		<< ", skipped for runtime calls taking the context: " << skipped << "\n";
+}
+
+/**
+	eliminateTimeRedundancy Function
+	--post instrumentation cleanup of the previous_time bookkeeping, block by block
+	--a store to previous_time that is overwritten by a later store of the same block before anything could read it
+	  is dropped, together with the current_time loads left without use
+	--every site restarts its interval after its own call (the second current_time read), so the instrumentation
+	  and its callee are attributed to no interval; that read is kept, the store before the call is the dead one
+	--calls read previous_time unless timeBlind proves otherwise, from the runtime bodies linkRuntime brought in
+	  and the te_time_blind annotations of detect.c, without the runtime bitcode only intrinsics are known blind
+*/
+void TimedExecution::eliminateTimeRedundancy(Module &M)
+{
+	GlobalVariable *current_gv = M.getGlobalVariable(StringRef("current_time"), true);
+	GlobalVariable *previous_gv = M.getGlobalVariable(StringRef("previous_time"), true);
+	if(current_gv == NULL || previous_gv == NULL) return;
+
+	//functions detect.c marks with __attribute__((annotate("te_time_blind")))
+	std::map<Function *, int> blind_map;
+	GlobalVariable *annotations = M.getGlobalVariable(StringRef("llvm.global.annotations"), true);
+	if(annotations && annotations->hasInitializer())
+		if(ConstantArray *CA = dyn_cast<ConstantArray>(annotations->getInitializer()))
+			for(unsigned i = 0; i < CA->getNumOperands(); i++)
+			{
+				ConstantStruct *CS = dyn_cast<ConstantStruct>(CA->getOperand(i));
+				if(CS == NULL || CS->getNumOperands() < 2) continue;
+				Function *AF = dyn_cast<Function>(CS->getOperand(0)->stripPointerCasts());
+				GlobalVariable *AG = dyn_cast<GlobalVariable>(CS->getOperand(1)->stripPointerCasts());
+				if(AF == NULL || AG == NULL || !AG->hasInitializer()) continue;
+				ConstantDataSequential *CD = dyn_cast<ConstantDataSequential>(AG->getInitializer());
+				if(CD && CD->isCString() && CD->getAsCString() == "te_time_blind") blind_map[AF] = 1;
+			}
+
+	int stores = 0, loads = 0, blind_calls = 0;
+	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
+	{
+		if(MI->isDeclaration() || MI->hasAvailableExternallyLinkage()) continue;
+		for(Function::iterator FI = MI->begin(), FE = MI->end(); FI != FE; FI++)
+		{
+			std::vector<Instruction *> dead_vector;
+			StoreInst *last_store = NULL;
+			for(BasicBlock::iterator BI = FI->begin(), BE = FI->end(); BI != BE; BI++)
+			{
+				Instruction *II = BI;
+				if(StoreInst *SI = dyn_cast<StoreInst>(II))
+				{
+					if(SI->getPointerOperand() != previous_gv || SI->isVolatile()) continue;
+					if(last_store) dead_vector.push_back(last_store);
+					last_store = SI;
+				}
+				else if(LoadInst *LI = dyn_cast<LoadInst>(II))
+				{
+					if(LI->getPointerOperand() == previous_gv) last_store = NULL;
+				}
+				else if(CallInst *CI = dyn_cast<CallInst>(II))
+				{
+					Function *callee = CI->getCalledFunction();
+					if(CI->isInlineAsm() || callee == NULL || !timeBlind(callee, previous_gv, blind_map)) last_store = NULL;
+					else blind_calls++;
+				}
+			}
+
+			for(std::vector<Instruction *>::iterator it = dead_vector.begin(); it != dead_vector.end(); it++)
+			{
+				Value *stored = cast<StoreInst>(*it)->getValueOperand();
+				(*it)->eraseFromParent();
+				stores++;
+				//its current_time load, unless the delta still uses it
+				LoadInst *LI = dyn_cast<LoadInst>(stored);
+				if(LI && LI->use_empty() && LI->getPointerOperand() == current_gv)
+				{
+					LI->eraseFromParent();
+					loads++;
+				}
+			}
+		}
+	}
+	int blind_functions = 0;
+	for(std::map<Function *, int>::iterator it = blind_map.begin(); it != blind_map.end(); it++)
+		blind_functions += it->second;
+	errs() << "time bookkeeping: " << stores << " stores and " << loads << " loads removed, " << blind_calls
+		<< " calls to " << blind_functions << " functions that never read previous_time\n";
+}
+
+/**
+	timeBlind Function
+	--1 when a call to F can not read previous_time: intrinsics other than the memory ones, functions annotated
+	  te_time_blind, and bodies that neither load previous_time nor call anything that could
+	--declarations, inline asm and bodies the linker may replace count as readers, memoized in blind_map,
+	  a function is taken as a reader while its own body is being looked at, which keeps recursion conservative
+*/
+int TimedExecution::timeBlind(Function *F, GlobalVariable *previous_gv, std::map<Function *, int> &blind_map)
+{
+	std::map<Function *, int>::iterator it = blind_map.find(F);
+	if(it != blind_map.end()) return it->second;
+	if(F->isIntrinsic())
+		return blind_map[F] = F->getIntrinsicID() != Intrinsic::memcpy && F->getIntrinsicID() != Intrinsic::memmove;
+	if(F->isDeclaration() || F->mayBeOverridden()) return blind_map[F] = 0;
+
+	blind_map[F] = 0;
+	for(Function::iterator FI = F->begin(), FE = F->end(); FI != FE; FI++)
+		for(BasicBlock::iterator BI = FI->begin(), BE = FI->end(); BI != BE; BI++)
+		{
+			Instruction *II = BI;
+			if(LoadInst *LI = dyn_cast<LoadInst>(II))
+			{
+				if(LI->getPointerOperand()->stripPointerCasts() == previous_gv) return 0;
+			}
+			else if(CallInst *CI = dyn_cast<CallInst>(II))
+			{
+				Function *callee = CI->getCalledFunction();
+				if(CI->isInlineAsm() || callee == NULL || !timeBlind(callee, previous_gv, blind_map)) return 0;
+			}
+			else if(isa<InvokeInst>(II)) return 0;
+		}
+	return blind_map[F] = 1;
+}
+
+/**
+	outlineReports Function
+	--moves every anomaly report out of the way of the checks: the runtime call goes through an internal cold,
+	  noinline wrapper in .text.unlikely, the branch into the report block gets !prof weights marking it cold,
+	  and the report block moves to the end of its function so the passing path falls through
+*/
+void TimedExecution::outlineReports(Module &M)
+{
+	const char *report_functions[] = {"instrument_function_report_anomaly", "instrument_function_cusum_alarm", "instrument_function_loop_anomaly", NULL};
+	MDBuilder MDB(M.getContext());
+	MDNode *report_taken = MDB.createBranchWeights(1, TE_REPORT_WEIGHT);
+	MDNode *report_not_taken = MDB.createBranchWeights(TE_REPORT_WEIGHT, 1);
+	int reports = 0;
+
+	for(int i = 0; report_functions[i]; i++)
+	{
+		Function *report_f = M.getFunction(report_functions[i]);
+		if(report_f == NULL) continue;
+
+		std::vector<CallInst *> call_vector;
+		for(Value::user_iterator UI = report_f->user_begin(), UE = report_f->user_end(); UI != UE; UI++)
+		{
+			CallInst *CI = dyn_cast<CallInst>(*UI);
+			if(CI && CI->getCalledFunction() == report_f && !CI->getParent()->getParent()->hasAvailableExternallyLinkage())
+				call_vector.push_back(CI);
+		}
+		if(call_vector.empty()) continue;
+
+		//the wrapper: same arguments, one call
+		Function *cold_f = Function::Create(report_f->getFunctionType(), GlobalValue::InternalLinkage, std::string("te_cold_") + report_functions[i], &M);
+		cold_f->addFnAttr(Attribute::Cold);
+		cold_f->addFnAttr(Attribute::NoInline);
+		cold_f->setSection(".text.unlikely");
+		IRBuilder<> IRB(BasicBlock::Create(M.getContext(), "entry", cold_f));
+		std::vector<Value *> args;
+		for(Function::arg_iterator AI = cold_f->arg_begin(), AE = cold_f->arg_end(); AI != AE; AI++)
+			args.push_back(AI);
+		IRB.CreateCall(report_f, args);
+		IRB.CreateRetVoid();
+
+		for(std::vector<CallInst *>::iterator it = call_vector.begin(); it != call_vector.end(); it++)
+		{
+			(*it)->setCalledFunction(cold_f);
+			BasicBlock *report_bb = (*it)->getParent();
+			for(pred_iterator PI = pred_begin(report_bb), PE = pred_end(report_bb); PI != PE; PI++)
+			{
+				BranchInst *BI = dyn_cast<BranchInst>((*PI)->getTerminator());
+				if(BI == NULL || !BI->isConditional()) continue;
+				BI->setMetadata(LLVMContext::MD_prof, BI->getSuccessor(0) == report_bb ? report_taken : report_not_taken);
+			}
+			report_bb->moveAfter(&report_bb->getParent()->back());
+			reports++;
+		}
+	}
+	errs() << "cold reports: " << reports << "\n";
+}
 
+/**
+	collectInnerLoops Function
+	--innermost loops under L that have a preheader and dedicated exits, the ones a single check can stand for
+*/
+void TimedExecution::collectInnerLoops(Loop *L, std::vector<Loop *> &loop_vector)
+{
+	if(!L->empty())
+	{
+		for(Loop::iterator LI = L->begin(), LE = L->end(); LI != LE; LI++)
+			collectInnerLoops(*LI, loop_vector);
+		return;
+	}
+	if(L->getLoopPreheader() && L->hasDedicatedExits())
+		loop_vector.push_back(L);
+}
 
-				Constant *myit_value_int = ConstantInt::get(I64Ty, 1);
-				Constant *mybit_value_int = ConstantInt::get(I64Ty, 2);
-				Constant *mycit_value_int = ConstantInt::get(I64Ty, 3);
-				Constant *str_para1 = createStringArg((char *)F->getName().str().c_str(), F);
-				Constant *str_para2 = createStringArg((char *)BB->getName().str().c_str(), F);
-				Value *args[] = {myit_value_int, myit_value_int, myit_value_int, myit_value_int, myit_value_int, mybit_value_int, mycit_value_int, str_para1, str_para2};
-				////IRBuilder<> IRB2(newBB2->getTerminator());
-				//IRB2.CreateCall(instru_detect1_f, args);
+/**
+	buildLoopModels Function
+	--per iteration statistics of the loops collectInnerLoops picks, from the raw mode 0 trace (./tdata.txt, ./ttdata.txt)
+	--a run starts at the first record of a loop block and ends at the next record of its function outside the loop,
+	  its ticks are the deltas of every type2 record in between, callees included, its trips the header records
+	--average: ticks / trips over all runs, stdev: of (ticks - trips * average) / sqrt(trips) over the runs
+	--saved to ./tloopdata.txt : each entry: function name, header bb name, runs, average, stdev
+	  merged with the entries other modules wrote, the loops of this module replaced
+*/
+void TimedExecution::buildLoopModels(Module &M, char *currentd, llvm::StringMap<struct loop_model> &loop_map)
+{
+	//loop blocks, keyed like the sites, mapped to the key of their header
+	llvm::StringMap<std::string> block_map;
+	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
+	{
+		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
+		LoopInfo &LI = getAnalysis<LoopInfo>(*F);
+		std::vector<Loop *> loop_vector;
+		for(LoopInfo::iterator LII = LI.begin(), LIE = LI.end(); LII != LIE; LII++)
+			collectInnerLoops(*LII, loop_vector);
+		for(std::vector<Loop *>::iterator lit = loop_vector.begin(); lit != loop_vector.end(); lit++)
+		{
+			std::string header_key = F->getName().str() + blockName((*lit)->getHeader());
+			for(Loop::block_iterator BI = (*lit)->block_begin(), BE = (*lit)->block_end(); BI != BE; BI++)
+				block_map[F->getName().str() + blockName(*BI)] = header_key;
+		}
+	}
 
+	char tgtemp1[300], tgtemp2[300];
+	strcpy(tgtemp1, currentd);
+	strcat(tgtemp1, "/tdata.txt");
+	strcpy(tgtemp2, currentd);
+	strcat(tgtemp2, "/ttdata.txt");
+	FILE *datafile = fopen(tgtemp1, "r");
+	FILE *tracefile = fopen(tgtemp2, "r");
+	if(!datafile || !tracefile)
+	{
+		errs() << "Timed Execution Configration Error: We should have a data file and a trace file.\n";
+		exit(-1);
+	}
 
+	//runs in progress: header key, function name, ticks, trips
+	struct loop_run
+	{
+		std::string header_key;
+		std::string function_name;
+		unsigned long ticks;
+		unsigned long trips;
+	};
+	std::vector<struct loop_run> run_vector;
+
+	char *line = NULL, *line2 = NULL, *line3 = NULL;
+	size_t len = 0, len2 = 0, len3 = 0;
+	ssize_t read, read2, read3;
+	while(((read = getline(&line, &len, datafile)) != -1)
+		&& ((read2 = getline(&line2, &len2, tracefile)) != -1)
+		&& ((read3 = getline(&line3, &len3, tracefile)) != -1))
+	{
+		//leave out last character '\n'
+		line[read-1] = '\0';
+		line2[read2-1] = '\0';
+		line3[read3-1] = '\0';
+		unsigned long bb_time = strtoul(line, NULL, 10);
+		std::string key = std::string(line2) + line3;
+		llvm::StringMap<std::string>::iterator bit = block_map.find(key);
+		std::string header_key = bit == block_map.end() ? std::string() : bit->getValue();
+
+		//a block of the same function outside the loop ends the run
+		for(size_t i = 0; i < run_vector.size(); )
+		{
+			if(run_vector[i].function_name != line2 || run_vector[i].header_key == header_key)
+			{
+				i++;
+				continue;
+			}
+			struct loop_model &lm = loop_map[run_vector[i].header_key];
+			if(lm.ticks.empty())
+			{
+				lm.function_name = line2;
+				lm.header_name = run_vector[i].header_key.substr(lm.function_name.size());
+			}
+			lm.ticks.push_back(run_vector[i].ticks);
+			lm.trips.push_back(run_vector[i].trips);
+			run_vector.erase(run_vector.begin() + i);
+		}
 
-				//add to newBB1, that is, the end
-				////IRBuilder<> IRB3(newBB1->getTerminator());
-				IRBuilder<> IRB3(BB->getTerminator());
-				gv = M.getGlobalVariable(StringRef("current_time"), true);
-				load = IRB3.CreateLoad(gv);
-				gv = M.getGlobalVariable(StringRef("previous_time"), true);
-				IRB3.CreateStore(load, gv);
+		if(!header_key.empty())
+		{
+			size_t i;
+			for(i = 0; i < run_vector.size(); i++)
+				if(run_vector[i].header_key == header_key) break;
+			if(i == run_vector.size())
+			{
+				struct loop_run run = {header_key, line2, 0, 0};
+				run_vector.push_back(run);
+			}
+			if(key == header_key)
+				run_vector[i].trips++;
+		}
 
+		if(bb_time != (unsigned long)-1)
+			for(std::vector<struct loop_run>::iterator rit = run_vector.begin(); rit != run_vector.end(); rit++)
+				rit->ticks += bb_time;
+	}
+	free(line);
+	free(line2);
+	free(line3);
+	fclose(datafile);
+	fclose(tracefile);
+
+	char tltemp[300], tltemp1[320];
+	strcpy(tltemp, currentd);
+	strcat(tltemp, "/tloopdata.txt");
+	std::vector<std::vector<std::string> > records;
+	readRecords(tltemp, 5, records);
+	sprintf(tltemp1, "%s.%d", tltemp, getpid());
+	FILE *file = fopen(tltemp1, "w");
+	for(std::vector<std::vector<std::string> >::iterator it = records.begin(); it != records.end(); it++)
+		if(!loop_map.count((*it)[0] + (*it)[1]))
+			fprintf(file, "%s\n%s\n%s\n%s\n%s\n", (*it)[0].c_str(), (*it)[1].c_str(), (*it)[2].c_str(), (*it)[3].c_str(), (*it)[4].c_str());
+	for(llvm::StringMap<struct loop_model>::iterator lit = loop_map.begin(); lit != loop_map.end(); lit++)
+	{
+		struct loop_model &lm = lit->getValue();
+		double ticks = 0, trips = 0, stdev = 0;
+		for(size_t i = 0; i < lm.ticks.size(); i++)
+		{
+			ticks += lm.ticks[i];
+			trips += lm.trips[i];
+		}
+		lm.average = trips > 0 ? ticks / trips : 0;
+		for(size_t i = 0; i < lm.ticks.size(); i++)
+			if(lm.trips[i] > 0)
+				stdev += (lm.ticks[i] - lm.trips[i] * lm.average) * (lm.ticks[i] - lm.trips[i] * lm.average) / lm.trips[i];
+		lm.stdev = sqrt(stdev / lm.ticks.size());
+		fprintf(file, "%s\n%s\n%lu\n%lf\n%lf\n", lm.function_name.c_str(), lm.header_name.c_str(), (unsigned long)lm.ticks.size(),
+			lm.average, lm.stdev);
+	}
+	fclose(file);
+	rename(tltemp1, tltemp);
+}
 
+/**
+	addCallSample Function
+	--adds the delta of one call of function_name, made from the context, to the call models of buildCallModels
+*/
+void TimedExecution::addCallSample(llvm::StringMap<struct site_model> &call_map, const std::string &function_name, int context,
+				unsigned long ticks)
+{
+	struct site_model &sm = call_map[function_name];
+	size_t j;
+	for(j = 0; j < sm.contexts.size(); j++)
+		if(sm.contexts[j].bb_num == context) break;
+	if(j == sm.contexts.size())
+	{
+		struct context_model cm;
+		cm.bb_num = context;
+		sm.contexts.push_back(cm);
+	}
+	sm.contexts[j].samples.push_back(ticks);
+	sm.function_name = function_name;
+	sm.bb_name = "entry";
+}
 
+/**
+	buildCallModels Function
+	--per call statistics of every function from the raw mode 0 trace (./tdata.txt, ./ttdata.txt), keyed by function name
+	--a call opens at the record of its entry block and closes at the record of a return block of the same function,
+	  its delta is the sum of the type2 deltas recorded in between, callees included, the entry record itself left out
+	--context: siteId of the caller block holding the call, the next record of the caller once the call closed,
+	  -1 for calls from outside the enclave
+	--the entry record is written at the end of the entry block, after the calls made from it: a call closed right
+	  before it, to a function the entry block calls, gets the entry block as its context, like at runtime
+	--callers in other modules get their id from siteKeyId as functions that are not static
+	--saved to ./tcalldata.txt : each entry: function name, context site id, samples, average, stdev
+	  merged with the entries other modules wrote, the functions of this trace replaced
+*/
+void TimedExecution::buildCallModels(Module &M, char *currentd, llvm::StringMap<struct site_model> &call_map)
+{
+	llvm::StringMap<BasicBlock *> block_map;
+	llvm::StringMap<int> return_map;
+	//functions called from the entry block of each function, "" for indirect calls
+	llvm::StringMap<std::set<std::string> > entry_call_map;
+	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
+	{
+		if(MI->isDeclaration() || MI->hasAvailableExternallyLinkage()) continue;
+		for(Function::iterator FI = MI->begin(), FE = MI->end(); FI != FE; FI++)
+		{
+			std::string key = MI->getName().str() + blockName(FI);
+			block_map[key] = FI;
+			if(isa<ReturnInst>(FI->getTerminator()))
+				return_map[key] = 1;
+			if(FI != MI->begin()) continue;
+			std::set<std::string> &call_set = entry_call_map[MI->getName()];
+			for(BasicBlock::iterator BI = FI->begin(), BE = FI->end(); BI != BE; BI++)
+			{
+				CallInst *CI = dyn_cast<CallInst>(BI);
+				if(CI == NULL || isa<IntrinsicInst>(CI)) continue;
+				call_set.insert(CI->getCalledFunction() ? CI->getCalledFunction()->getName().str() : "");
 			}
+		}
+	}
 
+	char tgtemp1[300], tgtemp2[300];
+	strcpy(tgtemp1, currentd);
+	strcat(tgtemp1, "/tdata.txt");
+	strcpy(tgtemp2, currentd);
+	strcat(tgtemp2, "/ttdata.txt");
+	FILE *datafile = fopen(tgtemp1, "r");
+	FILE *tracefile = fopen(tgtemp2, "r");
+	if(!datafile || !tracefile)
+	{
+		errs() << "Timed Execution Configration Error: We should have a data file and a trace file.\n";
+		exit(-1);
+	}
 
-			if(type1 == 1)
+	//open calls, innermost last, and closed calls waiting for the block of their caller
+	struct call_frame
+	{
+		std::string function_name;
+		unsigned long ticks;
+		size_t depth;
+	};
+	std::vector<struct call_frame> frame_vector, pending_vector;
+
+	char *line = NULL, *line2 = NULL, *line3 = NULL;
+	size_t len = 0, len2 = 0, len3 = 0;
+	ssize_t read, read2, read3;
+	while(((read = getline(&line, &len, datafile)) != -1)
+		&& ((read2 = getline(&line2, &len2, tracefile)) != -1)
+		&& ((read3 = getline(&line3, &len3, tracefile)) != -1))
+	{
+		//leave out last character '\n'
+		line[read-1] = '\0';
+		line2[read2-1] = '\0';
+		line3[read3-1] = '\0';
+		unsigned long bb_time = strtoul(line, NULL, 10);
+		std::string key = std::string(line2) + line3;
+
+		if(bb_time != (unsigned long)-1)
+			for(std::vector<struct call_frame>::iterator fit = frame_vector.begin(); fit != frame_vector.end(); fit++)
+				fit->ticks += bb_time;
+
+		//the entry block of a function holds the calls closed right before its entry record
+		if(strcmp(line3, "entry") == 0)
+		{
+			llvm::StringMap<std::set<std::string> >::iterator eit = entry_call_map.find(line2);
+			for(size_t i = 0; eit != entry_call_map.end() && block_map.count(key) && i < pending_vector.size(); )
 			{
-				//errs() << "type1!\n";
-				//errs() << function_name << " " << bb_name << " " << context_type1_bb_num << "\n";
-				Constant *bb_num_value = ConstantInt::get(I64Ty, context_type1_bb_num);
-				gv = M.getGlobalVariable(StringRef("pre_bb_num"), true);
-				IRBuilder<> IRB(BB->getTerminator());
-				IRB.CreateStore(bb_num_value, gv);//done.
+				if(pending_vector[i].depth != frame_vector.size() || (!eit->getValue().count(pending_vector[i].function_name)
+					&& !eit->getValue().count("")))
+				{
+					i++;
+					continue;
+				}
+				int context = cast<ConstantInt>(siteId(block_map[key]))->getSExtValue();
+				addCallSample(call_map, pending_vector[i].function_name, context, pending_vector[i].ticks);
+				pending_vector.erase(pending_vector.begin() + i);
 			}
+		}
 
-			//obsolete
-			/*if((strcmp(function_name, p_entry_function) == 0) && (strcmp(bb_name, F->back().getName().str().c_str()) == 0))
+		//the first record of the caller after the call is the block holding it, without a caller it came from outside
+		for(size_t i = 0; i < pending_vector.size(); )
+		{
+			if(pending_vector[i].depth != frame_vector.size() || (!frame_vector.empty() && frame_vector.back().function_name != line2))
 			{
-				//errs() << "F name: " << F->getName() << " " << "BB name: " << BB->getName() << "\n";
-				IRB.CreateCall(instru_dump_detection_result_f, initial_value_int_one);
-				gv = M.getGlobalVariable(StringRef("current_time"), true);
-				load = IRB.CreateLoad(gv);
-				gv = M.getGlobalVariable(StringRef("previous_time"), true);
-				IRB.CreateStore(load, gv);
-				//gv = M.getGlobalVariable(StringRef("current_time"), true);
-				//load = IRB.CreateLoad(gv);
-				//IRB.CreateCall(instru_print_long_long_int_to_debug_f, load);
-			}*/
+				i++;
+				continue;
+			}
+			llvm::StringMap<BasicBlock *>::iterator bit = block_map.find(key);
+			int context = frame_vector.empty() ? -1 : bit != block_map.end() ? cast<ConstantInt>(siteId(bit->getValue()))->getSExtValue()
+				: siteKeyId(line2, line3, "");
+			addCallSample(call_map, pending_vector[i].function_name, context, pending_vector[i].ticks);
+			pending_vector.erase(pending_vector.begin() + i);
+		}
 
-			free(bb_name);
-			bb_num_vector.clear();
-			time_vector.clear();
-			bb_num_vector1.clear();
-			visited_vector1.clear();
-			bb_num_vector2.clear();
-			average_vector2.clear();
-			stdev_vector2.clear();
-			b_vector3.clear();
-			c_vector3.clear();
+		if(strcmp(line3, "entry") == 0)
+		{
+			struct call_frame frame = {line2, 0, frame_vector.size()};
+			frame_vector.push_back(frame);
+		}
 
+		if(!frame_vector.empty() && frame_vector.back().function_name == line2 && return_map.count(key))
+		{
+			struct call_frame frame = frame_vector.back();
+			frame_vector.pop_back();
+			pending_vector.push_back(frame);
+		}
+	}
+	free(line);
+	free(line2);
+	free(line3);
+	fclose(datafile);
+	fclose(tracefile);
+	for(std::vector<struct call_frame>::iterator pit = pending_vector.begin(); pit != pending_vector.end(); pit++)
+		if(pit->depth == 0)
+			addCallSample(call_map, pit->function_name, -1, pit->ticks);
+
+	char tctemp[300], tctemp1[320];
+	strcpy(tctemp, currentd);
+	strcat(tctemp, "/tcalldata.txt");
+	std::vector<std::vector<std::string> > records;
+	readRecords(tctemp, 5, records);
+	sprintf(tctemp1, "%s.%d", tctemp, getpid());
+	FILE *file = fopen(tctemp1, "w");
+	for(std::vector<std::vector<std::string> >::iterator it = records.begin(); it != records.end(); it++)
+		if(!call_map.count((*it)[0]))
+			fprintf(file, "%s\n%s\n%s\n%s\n%s\n", (*it)[0].c_str(), (*it)[1].c_str(), (*it)[2].c_str(), (*it)[3].c_str(), (*it)[4].c_str());
+	for(llvm::StringMap<struct site_model>::iterator sit = call_map.begin(); sit != call_map.end(); sit++)
+	{
+		struct site_model &sm = sit->getValue();
+		for(std::vector<struct context_model>::iterator cit = sm.contexts.begin(); cit != sm.contexts.end(); cit++)
+		{
+			double average = 0, stdev = 0;
+			for(std::vector<unsigned long>::iterator myit = cit->samples.begin(); myit != cit->samples.end(); myit++)
+				average += *myit;
+			average /= cit->samples.size();
+			for(std::vector<unsigned long>::iterator myit = cit->samples.begin(); myit != cit->samples.end(); myit++)
+				stdev += (*myit - average) * (*myit - average);
+			stdev /= cit->samples.size();
+			cit->average = average;
+			cit->stdev = sqrt(stdev);
+			fprintf(file, "%s\n%d\n%lu\n%lf\n%lf\n", sm.function_name.c_str(), cit->bb_num, (unsigned long)cit->samples.size(),
+				cit->average, cit->stdev);
 		}
+	}
+	fclose(file);
+	rename(tctemp1, tctemp);
+}
 
-		//handle ecall entry and exit
-		if((strcmp(function_name, p_entry_function) == 0) && (M.getFunction(p_reference_function) != NULL))
+/**
+	labelBlocks Function
+	--with line 16 of tconfig.txt set to 1, names every block by a hash of its function name, its first debug location
+	  (file:line:col and the locations it is inlined at) and its CFG shape (preds, succs), instead of its IR name
+	--blocks hashing alike in one function are told apart by their order, the entry block stays "entry"
+	--so the pass can run late in an optimized pipeline, where names are stripped or renumbered
+*/
+void TimedExecution::labelBlocks(Module &M)
+{
+	block_labels.clear();
+	if(site_keys != 1) return;
+
+	int unlocated = 0;
+	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
+	{
+		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
+
+		std::map<uint64_t, int> ordinal_map;
+		for(Function::iterator FI = MI->begin(), FE = MI->end(); FI != FE; FI++)
 		{
-			//dump all detection timing infomation at the end of ecall
-			BasicBlock *BB = &(F->back());
-			BasicBlock::iterator BI, BE;
-			for(BI = BB->begin(), BE = BB->end(); BI != BE; BI++)
+			BasicBlock *BB = FI;
+			if(BB == &F->getEntryBlock())
 			{
-				Instruction *II = BI;
-				if(isa<ReturnInst>(II)) break; //|| isa<CallInst>(II)) break;
+				block_labels[BB] = "entry";
+				continue;
 			}
 
-			if(BI == BE)
+			std::string location = "?";
+			for(BasicBlock::iterator BI = BB->begin(), BE = BB->end(); BI != BE; BI++)
 			{
-			errs() << "----------------------------------------------------------------------------------\n";
-			errs() << "----------------------------------------------------------------------------------\n";
-			errs() << "----------------------------------------------------------------------------------\n";
-			errs() << "----------------------------------------------------------------------------------\n";
-			errs() << "-----------found! ------------------------------------------1---------------------\n";
-			errs() << "----------------------------------------------------------------------------------\n";
-			errs() << "----------------------------------------------------------------------------------\n";
-			errs() << "----------------------------------------------------------------------------------\n";
-			errs() << "----------------------------------------------------------------------------------\n";
-
-				IRBuilder<> IRB1(F->back().getTerminator());
+				DebugLoc DL = BI->getDebugLoc();
+				if(DL.isUnknown() || isa<DbgInfoIntrinsic>(BI)) continue;
+				location = "";
+				for(; !DL.isUnknown(); DL = DebugLoc::getFromDILocation(DL.getInlinedAt(M.getContext())))
+				{
+					DIScope scope(DL.getScope(M.getContext()));
+					location += scope.getFilename().str() + ":" + std::to_string(DL.getLine()) + ":" + std::to_string(DL.getCol()) + "@";
+				}
+				break;
+			}
+			if(location == "?") unlocated++;
 
+			int num_pred = 0, num_succ = 0;
+			for(pred_iterator PI = pred_begin(BB), E = pred_end(BB); PI != E; PI++)
+				num_pred++;
+			for(succ_iterator SI = succ_begin(BB), E = succ_end(BB); SI != E; SI++)
+				num_succ++;
+			std::string shape = F->getName().str() + "|" + location + "|" + std::to_string(num_pred) + "|" + std::to_string(num_succ);
+
+			//FNV-1a
+			uint64_t hash = 0xcbf29ce484222325ULL;
+			for(size_t i = 0; i < shape.size(); i++)
+				hash = (hash ^ (unsigned char)shape[i]) * 0x100000001b3ULL;
+
+			char label[40];
+			int ordinal = ordinal_map[hash]++;
+			if(ordinal == 0) sprintf(label, "b%016llx", (unsigned long long)hash);
+			else sprintf(label, "b%016llx.%d", (unsigned long long)hash, ordinal);
+			block_labels[BB] = label;
+		}
+	}
+	errs() << "blocks labelled by debug location: " << block_labels.size() << ", without any location: " << unlocated << "\n";
+}
 
-				//IRB1.CreateCall(instru_print_time_f, initial_value_int_zero);
-				IRB1.CreateCall(instru_dump_detection_result_f, initial_value_int_zero);
-				////IRB1.CreateCall(instru_set_loop_false_f, initial_value_int_zero);
+/**
+	blockName Function
+	--the name a block goes by in the training files and site keys, see labelBlocks
+	--blocks made by the instrumentation have no label and keep their IR name
+*/
+std::string TimedExecution::blockName(BasicBlock *BB)
+{
+	std::map<BasicBlock *, std::string>::iterator it = block_labels.find(BB);
+	if(it != block_labels.end()) return it->second;
+	return BB->getName().str();
+}
 
-				//get time again after our time consuming process
-				//gv = M.getGlobalVariable(StringRef("current_time"), true);
-				//load = IRB1.CreateLoad(gv);
-				//gv = M.getGlobalVariable(StringRef("previous_time"), true);
-				//IRB1.CreateStore(load, gv);
+/**
+	sampleChecks Function
+	--runs the check of every instrument_function_detect site only on every N-th execution, N from ./tsampledata.txt
+	  (each entry: function name, bb name, N) or line 17 of tconfig.txt for the sites it does not list
+	--each sampled site gets a private countdown: the skipped path decrements it and restarts the interval, the due path
+	  reloads it and calls the check, with !prof weights 1 : N - 1
+	--line 18 of tconfig.txt set to 1 reloads with instrument_function_sample_next instead, uniform in [1, 2N - 1],
+	  from a state instrument_function_sample_seed draws from rdrand at every ecall entry (detect.c)
+	  the countdown starts at 0: the first execution only draws it and skips the check, so the first checked
+	  execution is random as well
+*/
+void TimedExecution::sampleChecks(Module &M, char *currentd)
+{
+	Function *detect_f = M.getFunction("instrument_function_detect");
+	if(detect_f == NULL) return;
 
+	llvm::StringMap<long> period_map;
+	char tstemp[300];
+	strcpy(tstemp, currentd);
+	strcat(tstemp, "/tsampledata.txt");
+	FILE *sfile = fopen(tstemp, "r");
+	if(sfile)
+	{
+		char *line = NULL;
+		size_t len = 0;
+		ssize_t read;
+		int count = 0;
+		std::string key;
+		while((read = getline(&line, &len, sfile)) != -1)
+		{
+			//leave out last character '\n'
+			line[read-1] = '\0';
+			if(count % 3 == 0) key = line;
+			else if(count % 3 == 1) key += line;
+			else period_map[key] = atol(line);
+			count++;
+		}
+		free(line);
+		fclose(sfile);
+	}
 
+	LLVMContext &llvm_context = M.getContext();
+	Type *I64Ty = Type::getInt64Ty(llvm_context);
+	Value *sample_next_f = M.getOrInsertFunction("instrument_function_sample_next", I64Ty, I64Ty, nullptr);
+	Value *sample_seed_f = M.getOrInsertFunction("instrument_function_sample_seed", I64Ty, I64Ty, nullptr);
+	Constant *one = ConstantInt::get(I64Ty, 1);
+
+	std::vector<CallInst *> call_vector;
+	for(Value::user_iterator UI = detect_f->user_begin(), UE = detect_f->user_end(); UI != UE; UI++)
+	{
+		CallInst *CI = dyn_cast<CallInst>(*UI);
+		if(CI && CI->getCalledFunction() == detect_f && !CI->getParent()->getParent()->hasAvailableExternallyLinkage())
+			call_vector.push_back(CI);
+	}
+
+	int sampled = 0;
+	for(std::vector<CallInst *>::iterator it = call_vector.begin(); it != call_vector.end(); it++)
+	{
+		CallInst *CI = *it;
+		BasicBlock *BB = CI->getParent();
+		llvm::StringMap<long>::iterator pit = period_map.find(BB->getParent()->getName().str() + blockName(BB));
+		long period = pit != period_map.end() ? pit->getValue() : sample_period;
+		if(period <= 1) continue;
+
+		Constant *period_value = ConstantInt::get(I64Ty, period);
+		Constant *zero = ConstantInt::get(I64Ty, 0);
+		GlobalVariable *countdown = new GlobalVariable(M, I64Ty, false, GlobalValue::PrivateLinkage,
+				sample_random ? zero : period_value, ".te_countdown");
+		IRBuilder<> IRB(CI);
+		Value *current = IRB.CreateLoad(countdown);
+		Value *left = IRB.CreateSub(current, one);
+		//due at 1, and at 0 before the first draw
+		Value *due = IRB.CreateICmpULE(current, one);
+
+		TerminatorInst *due_term, *skip_term;
+		SplitBlockAndInsertIfThenElse(due, CI, &due_term, &skip_term, MDBuilder(llvm_context).createBranchWeights(1, period - 1));
+
+		IRBuilder<> IRB1(due_term);
+		IRB1.CreateStore(sample_random ? (Value *)IRB1.CreateCall(sample_next_f, period_value) : (Value *)period_value, countdown);
+		CI->moveBefore(due_term);
+		if(sample_random)
+		{
+			//the first draw only, no check
+			IRBuilder<> IRB4(CI);
+			TerminatorInst *first_term, *check_term;
+			SplitBlockAndInsertIfThenElse(IRB4.CreateICmpEQ(current, zero), CI, &first_term, &check_term);
+			CI->moveBefore(check_term);
+			IRBuilder<> IRB3(first_term);
+			LoadInst *load = IRB3.CreateLoad(M.getGlobalVariable(StringRef("current_time"), true));
+			IRB3.CreateStore(load, M.getGlobalVariable(StringRef("previous_time"), true));
+		}
 
-			}
-			else
-			{
+		IRBuilder<> IRB2(skip_term);
+		IRB2.CreateStore(left, countdown);
+		LoadInst *load = IRB2.CreateLoad(M.getGlobalVariable(StringRef("current_time"), true));
+		IRB2.CreateStore(load, M.getGlobalVariable(StringRef("previous_time"), true));
+		sampled++;
+	}
 
-			errs() << "----------------------------------------------------------------------------------\n";
-			errs() << "----------------------------------------------------------------------------------\n";
-			errs() << "----------------------------------------------------------------------------------\n";
-			errs() << "----------------------------------------------------------------------------------\n";
-			errs() << "-----------found! ------------------------------------------2---------------------\n";
-			errs() << "----------------------------------------------------------------------------------\n";
-			errs() << "----------------------------------------------------------------------------------\n";
-			errs() << "----------------------------------------------------------------------------------\n";
-			errs() << "----------------------------------------------------------------------------------\n";
+	//fresh random countdowns every ecall
+	Function *entry_f = M.getFunction(p_entry_function);
+	if(sample_random && sampled && entry_f && !entry_f->isDeclaration() && M.getFunction(p_reference_function) != NULL)
+	{
+		IRBuilder<> IRB(entry_f->front().getFirstInsertionPt());
+		IRB.CreateCall(sample_seed_f, ConstantInt::get(I64Ty, 0));
+	}
+	errs() << "sampled sites: " << sampled << " of " << call_vector.size() << "\n";
+}
 
+/**
+	budgetSiteModels Function
+	--keeps the checks within overhead_budget (line 19 of tconfig.txt, e.g. 0.05) of the ticks of the training trace
+	--cost of a site: its executions in the trace * check_cost (line 20, ticks per check), coverage: the ticks of the
+	  intervals it checks, sites are taken by coverage per cost while they fit
+	--executions (execution_map) are counted before pruning: the check runs for pruned contexts as well, it just finds
+	  no bounds for them
+	--sites left out go to reset_map like the pruned ones
+	--./tbudgetdata.txt (budget_name) : each entry: function name, basic block name, executions, covered ticks, 1 kept or 0 left out
+*/
+void TimedExecution::budgetSiteModels(char *currentd, llvm::StringMap<struct site_model> &site_map, llvm::StringMap<int> &reset_map,
+				llvm::StringMap<double> &execution_map, double total_ticks, const char *budget_name)
+{
+	std::vector<std::pair<double, std::string> > ratio_vector;
+	for(llvm::StringMap<struct site_model>::iterator sit = site_map.begin(); sit != site_map.end(); sit++)
+	{
+		double executions = execution_map[sit->getKey()], ticks = 0;
+		for(std::vector<struct context_model>::iterator cit = sit->getValue().contexts.begin(); cit != sit->getValue().contexts.end(); cit++)
+			ticks += cit->average * std::max((double)cit->samples.size(), cit->digest.total);
+		ratio_vector.push_back(std::make_pair(executions > 0 ? ticks / executions : 0, sit->getKey().str()));
+	}
+	std::sort(ratio_vector.rbegin(), ratio_vector.rend());
+
+	char tbtemp[300], tbtemp1[320];
+	strcpy(tbtemp, currentd);
+	strcat(tbtemp, budget_name);
+	sprintf(tbtemp1, "%s.%d", tbtemp, getpid());
+	FILE *bfile = fopen(tbtemp1, "w");
+
+	double budget = overhead_budget * total_ticks, spent = 0, covered = 0, uncovered = 0;
+	std::vector<std::string> dropped_vector;
+	for(std::vector<std::pair<double, std::string> >::iterator it = ratio_vector.begin(); it != ratio_vector.end(); it++)
+	{
+		struct site_model &sm = site_map[it->second];
+		double executions = execution_map[it->second], ticks = 0;
+		for(std::vector<struct context_model>::iterator cit = sm.contexts.begin(); cit != sm.contexts.end(); cit++)
+			ticks += cit->average * std::max((double)cit->samples.size(), cit->digest.total);
+		int kept = spent + executions * check_cost <= budget;
+		if(kept)
+		{
+			spent += executions * check_cost;
+			covered += ticks;
+		}
+		else
+		{
+			uncovered += ticks;
+			dropped_vector.push_back(it->second);
+		}
+		fprintf(bfile, "%s\n%s\n%lu\n%lf\n%d\n", sm.function_name.c_str(), sm.bb_name.c_str(), (unsigned long)executions, ticks, kept);
+	}
+	for(std::vector<std::string>::iterator it = dropped_vector.begin(); it != dropped_vector.end(); it++)
+	{
+		site_map.erase(*it);
+		reset_map[*it] = 1;
+	}
 
-				IRBuilder<> IRB1((Instruction *)BI);
-				errs() << "2\n";
-				//IRB1.CreateCall(instru_print_time_f, initial_value_int_zero);
-				IRB1.CreateCall(instru_dump_detection_result_f, initial_value_int_zero);
-				////IRB1.CreateCall(instru_set_loop_false_f, initial_value_int_zero);
+	fclose(bfile);
+	rename(tbtemp1, tbtemp);
+	errs() << "overhead budget: " << overhead_budget << ", spent: " << (total_ticks > 0 ? spent / total_ticks : 0)
+		<< ", sites kept: " << site_map.size() << ", left out: " << dropped_vector.size()
+		<< ", coverage: " << (covered + uncovered > 0 ? covered / (covered + uncovered) : 0) << "\n";
+}
 
-				//get time again after our time consuming process
-				//gv = M.getGlobalVariable(StringRef("current_time"), true);
-				//load = IRB1.CreateLoad(gv);
-				//gv = M.getGlobalVariable(StringRef("previous_time"), true);
-				//IRB1.CreateStore(load, gv);
+/**
+	duplicateTails Function
+	--with line 21 of tconfig.txt above 0, gives every incoming edge of a small multi predecessor block its own copy,
+	  when (preds - 1) * instructions stays within it, so each copy has one predecessor, one context
+	--the copies stay type2 sites (tail_copies), each checked against its one context
+	--the contexts of a type2 block are its predecessors, so the successors of the block gain one per copy:
+	  blocks with a successor that would end up with more than TE_INLINE_CONTEXTS predecessors are left alone
+	--the largest context count and the sites above TE_INLINE_CONTEXTS before and after are printed
+	--left alone: the entry block, the return block of the ecall, landing pads, loop headers (a predecessor it dominates), blocks whose values are
+	  used outside of them, and blocks reached by anything but a branch or a switch edge, or twice from one block
+	--runs before any mode, so training (modes -1, 0) and detection see the same CFG, copies are named <block>.te<n>
+	--generalizes the hand written splitBasicBlock experiment of mode 4
+*/
+void TimedExecution::duplicateTails(Module &M)
+{
+	if(duplicate_limit <= 0) return;
 
-			}
+	int duplicated = 0, copies = 0, crowded = 0;
+	long growth = 0;
+	int max_before = 0, over_before = 0;
+	contextCounts(M, max_before, over_before);
+	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
+	{
+		Function *F = MI;
+		if(F->isDeclaration() || F->hasAvailableExternallyLinkage()) continue;
 
+		std::vector<BasicBlock *> bb_vector;
+		for(Function::iterator FI = MI->begin(), FE = MI->end(); FI != FE; FI++)
+			bb_vector.push_back(FI);
 
+		DominatorTree DT;
+		DT.recalculate(*F);
+		for(std::vector<BasicBlock *>::iterator bit = bb_vector.begin(); bit != bb_vector.end(); bit++)
+		{
+			BasicBlock *BB = *bit;
+			if(BB == &F->getEntryBlock() || BB->isLandingPad()) continue;
+			//the ecall exit is instrumented at its one return block
+			if(isa<ReturnInst>(BB->getTerminator()) && strcmp(F->getName().str().c_str(), p_entry_function) == 0) continue;
 
+			std::vector<BasicBlock *> pred_vector;
+			int eligible = 1;
+			for(pred_iterator PI = pred_begin(BB), E = pred_end(BB); PI != E && eligible; PI++)
+			{
+				TerminatorInst *TI = (*PI)->getTerminator();
+				if(std::find(pred_vector.begin(), pred_vector.end(), *PI) != pred_vector.end()) eligible = 0;
+				else if(!isa<BranchInst>(TI) && !isa<SwitchInst>(TI)) eligible = 0;
+				else if(DT.dominates(BB, *PI)) eligible = 0;
+				pred_vector.push_back(*PI);
+			}
+			if(!eligible || pred_vector.size() < 2) continue;
 
-			//init timer thread at the beginning of ecall
-			//clear earlier ecall records at the beginning of ecall
-			IRBuilder<> IRB(F->front().getFirstInsertionPt());
-			//IRB.CreateCall(instru_init_f, initial_value_int_zero);
-			//IRB.CreateCall(instru_print_time_f, initial_value_int_zero);
-			//IRB.CreateCall(instru_clear_record_f, initial_value_int_zero);
-		}
+			//the successors must stay within TE_INLINE_CONTEXTS contexts
+			for(succ_iterator SI = succ_begin(BB), E = succ_end(BB); SI != E && eligible; SI++)
+			{
+				size_t num_pred = 0;
+				for(pred_iterator PI = pred_begin(*SI), PE = pred_end(*SI); PI != PE; PI++)
+					num_pred++;
+				if(num_pred + pred_vector.size() - 1 > TE_INLINE_CONTEXTS) eligible = 0;
+			}
+			if(!eligible)
+			{
+				crowded++;
+				continue;
+			}
 
+			long size = 0;
+			for(BasicBlock::iterator BI = BB->begin(), BE = BB->end(); BI != BE && eligible; BI++)
+			{
+				if(!isa<PHINode>(BI) && !isa<DbgInfoIntrinsic>(BI)) size++;
+				for(Value::user_iterator UI = BI->user_begin(), UE = BI->user_end(); UI != UE; UI++)
+					if(cast<Instruction>(*UI)->getParent() != BB) eligible = 0;
+			}
+			if(!eligible || size * (long)(pred_vector.size() - 1) > duplicate_limit) continue;
 
+			//the first predecessor keeps the block
+			for(size_t i = 1; i < pred_vector.size(); i++)
+			{
+				BasicBlock *pred = pred_vector[i];
+				ValueToValueMapTy VMap;
+				BasicBlock *copy = CloneBasicBlock(BB, VMap, ".te" + std::to_string(i), F);
+				copy->moveAfter(BB);
+				for(BasicBlock::iterator BI = copy->begin(), BE = copy->end(); BI != BE; BI++)
+					RemapInstruction(BI, VMap, RF_IgnoreMissingEntries);
 
+				//phis of the copy collapse to the value of its one edge
+				while(PHINode *PN = dyn_cast<PHINode>(copy->begin()))
+				{
+					PN->replaceAllUsesWith(PN->getIncomingValueForBlock(pred));
+					PN->eraseFromParent();
+				}
+				for(BasicBlock::iterator BI = BB->begin(); PHINode *PN = dyn_cast<PHINode>(BI); BI++)
+					PN->removeIncomingValue(pred, false);
+
+				//successors see the copy like the block
+				for(succ_iterator SI = succ_begin(copy), E = succ_end(copy); SI != E; SI++)
+					for(BasicBlock::iterator BI = SI->begin(); PHINode *PN = dyn_cast<PHINode>(BI); BI++)
+						PN->addIncoming(PN->getIncomingValueForBlock(BB), copy);
+
+				TerminatorInst *TI = pred->getTerminator();
+				for(unsigned j = 0; j < TI->getNumSuccessors(); j++)
+					if(TI->getSuccessor(j) == BB) TI->setSuccessor(j, copy);
+				tail_copies.insert(copy);
+				copies++;
+			}
+			growth += size * (pred_vector.size() - 1);
+			duplicated++;
+			DT.recalculate(*F);
+		}
 	}
+	int max_after = 0, over_after = 0;
+	contextCounts(M, max_after, over_after);
+	errs() << "duplicated tails: " << duplicated << ", copies: " << copies << ", instructions added: " << growth
+		<< ", left alone for their successors: " << crowded << "\n";
+	errs() << "contexts per site, largest: " << max_before << " -> " << max_after << ", sites above " << TE_INLINE_CONTEXTS
+		<< ": " << over_before << " -> " << over_after << "\n";
+}
 
-
+/**
+	contextCounts Function
+	--static context counts of the type2 sites: a context is the type1 block run last, i.e. a predecessor of the site
+	--largest: the most contexts of any site, over: sites with more than TE_INLINE_CONTEXTS
+*/
+void TimedExecution::contextCounts(Module &M, int &largest, int &over)
+{
+	largest = 0;
+	over = 0;
+	for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++)
+	{
+		if(MI->isDeclaration() || MI->hasAvailableExternallyLinkage()) continue;
+		for(Function::iterator FI = MI->begin(), FE = MI->end(); FI != FE; FI++)
+		{
+			if(!isType2Block(FI)) continue;
+			int num_pred = 0;
+			for(pred_iterator PI = pred_begin(FI), E = pred_end(FI); PI != E; PI++)
+				num_pred++;
+			largest = std::max(largest, num_pred);
+			if(num_pred > TE_INLINE_CONTEXTS) over++;
+		}
 	}
-
-	return true;
 }
 
+/**
+	readRecords Function
+	--reads a data file of records with a fixed number of lines each, a missing file gives no records
+	--the files written per module (tsymdata, tloopdata, tcalldata, tprunedata) are merged with it, so every
+	  translation unit of the enclave adds to them instead of replacing what the others wrote
+*/
+void TimedExecution::readRecords(const char *path, int fields, std::vector<std::vector<std::string> > &records)
+{
+	FILE *file = fopen(path, "r");
+	if(file == NULL) return;
+	char *line = NULL;
+	size_t len = 0;
+	ssize_t read;
+	std::vector<std::string> record;
+	while((read = getline(&line, &len, file)) != -1)
+	{
+		//leave out last character '\n'
+		if(read > 0 && line[read-1] == '\n') line[read-1] = '\0';
+		record.push_back(line);
+		if((int)record.size() == fields)
+		{
+			records.push_back(record);
+			record.clear();
+		}
+	}
+	free(line);
+	fclose(file);
+}
 
 //obsolete
 /*void TimedExecution::markBBNumType1Type2Info(char *function_name, char *bb_name, int bb_count, int type1, int type2)
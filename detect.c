@@ -0,0 +1,363 @@
+//detection runtime of the TimedExecution pass, inside the enclave next to timer.c
+//sites are reported by id, ./tsymdata.txt written by the pass maps them to function, basic block and source line
+//clang -emit-llvm -c detect.c -o detect.bc and line 14 of tconfig.txt let the pass link it in for inlining
+
+#include <stdarg.h>
+#include <stdio.h>      /* vsnprintf */
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include "Enclave_t.h"
+
+extern void printf(const char *fmt, ...);
+
+//calls to these never read previous_time, eliminateTimeRedundancy in TimedExecution.cpp finds them by this annotation
+//in the linked bitcode, every other function is judged by its body, printf alone would make a report look like a reader
+#define TE_TIME_BLIND __attribute__((annotate("te_time_blind")))
+
+//number of log2 scaled bins per histogram, must match TimedExecution.cpp
+#define TE_HIST_BINS 16
+
+//mode 23 table entries, packed by TimedExecution.cpp
+struct te_entry8
+{
+	unsigned short ctx;
+	unsigned char b, c;
+};
+
+struct te_entry16
+{
+	unsigned short ctx, b, c;
+};
+
+//site table of instrument_function_detect, emitted by emitDetectCall in TimedExecution.cpp
+#define TE_TABLE_EMPTY 0x8000000000000000UL
+
+struct te_site
+{
+	long n;
+	long hash_bits;
+	const long *ctx;
+	const long *b;
+	const long *c;
+	int site_id;
+};
+
+//timer.c
+extern volatile unsigned long current_time;
+extern volatile unsigned long previous_time;
+//last type1 context, stored by the instrumented code
+extern long pre_bb_num;
+
+//global variables
+unsigned long histogram_anormaly_total = 0;
+unsigned long cusum_anormaly_total = 0;
+unsigned long report_anormaly_total = 0;
+unsigned long compact_anormaly_total = 0;
+unsigned long table_anormaly_total = 0;
+unsigned long detect_anormaly_total = 0;
+unsigned long loop_anormaly_total = 0;
+//check timing, summed by the instrumented code when line 13 of tconfig.txt is 1
+unsigned long te_check_cycles = 0;
+unsigned long te_check_count = 0;
+//mode 24: input class of the running ecall
+long te_input_class = 0;
+//mode 28: site id of the block calling a function checked per call, -1 outside of such calls
+long te_call_site = -1;
+//mode 19: updated inline by the instrumented code
+long cusum_statistic = 0;
+//mode 16: 1 while the running interval gets faults injected, read by the instrumented code when it records the interval
+long te_fault_armed = 1;
+//mode 16: intervals left until the next faulted one, not static for the same reason as te_sample_state
+long te_fault_countdown = 1;
+
+//must match siteHash in TimedExecution.cpp
+static inline unsigned long te_site_hash(long ctx, long hash_bits)
+{
+	return ((unsigned long)ctx * 0x9E3779B97F4A7C15UL) >> (64 - hash_bits);
+}
+
+//bin 0 holds delta 0, bin k holds [2^(k-1), 2^k), the last bin holds everything above
+static inline long te_hist_bin(unsigned long delta)
+{
+	long bin;
+
+	if(delta == 0)
+		return 0;
+	bin = 64 - __builtin_clzl(delta);
+	return bin < TE_HIST_BINS ? bin : TE_HIST_BINS - 1;
+}
+
+//failing paths of the checks linkRuntime inlines, out of line so the inlined fast paths stay a compare and branch
+static void TE_TIME_BLIND __attribute__((noinline, cold)) te_histogram_report(int site_id, long pre, long delta)
+{
+	histogram_anormaly_total++;
+	printf("histogram anormaly: site %d, context: %ld, delta: %ld\n", site_id, pre, delta);
+}
+
+static void TE_TIME_BLIND __attribute__((noinline, cold)) te_compact_report(int site_id, long pre, long delta)
+{
+	compact_anormaly_total++;
+	printf("compact anormaly: site %d, context: %ld, delta: %ld\n", site_id, pre, delta);
+}
+
+static void TE_TIME_BLIND __attribute__((noinline, cold)) te_table_report(int site_id, long pre, long delta)
+{
+	table_anormaly_total++;
+	printf("class %ld anormaly: site %d, context: %ld, delta: %ld\n", te_input_class, site_id, pre, delta);
+}
+
+/**
+	mode 14: score the delta with one lookup in the histogram of its context
+	ctx: 2^hash_bits slots open addressed by te_site_hash, TE_TABLE_EMPTY when free, at most half of them used,
+	hist: one row of TE_HIST_BINS one byte scores per slot
+*/
+void instrument_function_detect_histogram(long pre_bb_num, long delta, const long *ctx, const unsigned char *hist,
+					long hash_bits, long limit, int site_id)
+{
+	unsigned long mask = (1UL << hash_bits) - 1;
+	unsigned long i;
+
+	for(i = te_site_hash(pre_bb_num, hash_bits); ctx[i] != pre_bb_num; i = (i + 1) & mask)
+		//context never seen in training, nothing to score against
+		if((unsigned long)ctx[i] == TE_TABLE_EMPTY)
+			return;
+	if(delta < 0)
+		return;
+
+	if(__builtin_expect(hist[i * TE_HIST_BINS + te_hist_bin(delta)] > limit, 0))
+		te_histogram_report(site_id, pre_bb_num, delta);
+}
+
+/**
+	mode 16: flush the line before the access, the refill cost a page fault leaves behind, in faulted intervals only
+*/
+void instrument_function_inject_fault(char *ptr)
+{
+	if(te_fault_armed)
+		_mm_clflush(ptr);
+}
+
+/**
+	mode 16: spin delay ticks of the secure timer, the cost of the exit itself
+*/
+void instrument_function_inject_delay(long delay)
+{
+	unsigned long end = current_time + delay;
+
+	while(current_time < end);
+}
+
+/**
+	mode 19: called only when the cusum statistic crosses its limit
+	a score above limit / 2 counts as limit / 2, so a single page fault does not alarm alone,
+	the instrumented code leaves this cap to the cold path, a real alarm starts collecting evidence again
+*/
+void TE_TIME_BLIND instrument_function_cusum_alarm(long statistic, long score, long limit, int site_id)
+{
+	long capped = statistic - score + (score < limit / 2 ? score : limit / 2);
+
+	if(capped <= limit)
+	{
+		cusum_statistic = capped;
+		return;
+	}
+	cusum_anormaly_total++;
+	printf("cusum anormaly: site %d, statistic: %ld\n", site_id, statistic);
+	cusum_statistic = 0;
+}
+
+/**
+	inline checks (modes 20, 25, 26) call it only when delta is outside the bounds of its context
+	static checks of untrained sites (modes 14, 15, 17, 19, 20) report context -1
+*/
+void TE_TIME_BLIND instrument_function_report_anomaly(long pre_bb_num, long delta, int site_id)
+{
+	report_anormaly_total++;
+	printf("anormaly: site %d, context: %ld, delta: %ld\n", site_id, pre_bb_num, delta);
+}
+
+/**
+	mode 27: one run of an aggregated loop took total ticks over trips header executions, outside its scaled bounds
+*/
+void TE_TIME_BLIND instrument_function_loop_anomaly(long trips, long total, int site_id)
+{
+	loop_anormaly_total++;
+	printf("loop anormaly: site %d, trips: %ld, total: %ld\n", site_id, trips, total);
+}
+
+/**
+	mode 23: bounds of context i are [b << shift, c << shift], pre_bb_num holds the dense context index
+*/
+static inline void te_compact_check(long pre_bb_num, long delta, unsigned long b, unsigned long c, long shift,
+					int site_id)
+{
+	if(__builtin_expect((unsigned long)delta < (b << shift) || (unsigned long)delta > (c << shift), 0))
+		te_compact_report(site_id, pre_bb_num, delta);
+}
+
+void instrument_function_detect_compact8(long pre_bb_num, long delta, const void *table_arg, long n, long shift,
+					int site_id)
+{
+	const struct te_entry8 *table = table_arg;
+	long i;
+
+	for(i = 0; i < n; i++)
+		if(table[i].ctx == pre_bb_num)
+		{
+			te_compact_check(pre_bb_num, delta, table[i].b, table[i].c, shift, site_id);
+			return;
+		}
+}
+
+void instrument_function_detect_compact16(long pre_bb_num, long delta, const void *table_arg, long n, long shift,
+					int site_id)
+{
+	const struct te_entry16 *table = table_arg;
+	long i;
+
+	for(i = 0; i < n; i++)
+		if(table[i].ctx == pre_bb_num)
+		{
+			te_compact_check(pre_bb_num, delta, table[i].b, table[i].c, shift, site_id);
+			return;
+		}
+}
+
+/**
+	mode 24: class of the request the ecall serves, the enclave overrides it with its own classifier
+	args: the n arguments of the ecall, pointers and integers as 64 bit integers, floating point as the bits of a double
+*/
+long __attribute__((weak)) instrument_function_classify_input(const long *args, long n)
+{
+	return 0;
+}
+
+void instrument_function_set_input_class(long classes, const long *args, long n)
+{
+	long k = instrument_function_classify_input(args, n);
+
+	te_input_class = (k >= 0 && k < classes) ? k : 0;
+}
+
+/**
+	mode 24: table of the current input class: n, then n (context, b, c)
+*/
+void instrument_function_detect_table(long pre_bb_num, long delta, const long *table, int site_id)
+{
+	long i, n = table[0];
+
+	for(i = 0; i < n; i++)
+		if(table[1 + i * 3] == pre_bb_num)
+			break;
+	if(i == n)
+		return;
+
+	if(__builtin_expect(delta < table[2 + i * 3] || delta > table[3 + i * 3], 0))
+		te_table_report(site_id, pre_bb_num, delta);
+}
+
+//the failing path of instrument_function_detect
+static void TE_TIME_BLIND __attribute__((noinline, cold)) te_detect_report(int site_id, long pre, long delta)
+{
+	detect_anormaly_total++;
+	printf("anormaly: site %d, context: %ld, delta: %ld\n", site_id, pre, delta);
+}
+
+/**
+	every table driven site: finds the context of pre_bb_num, checks the delta against [b, c], restarts the interval
+	sorted tables are searched by a branchless binary search, hashed ones by linear probing
+	tables are passed as void * so the types match the declarations of the pass when this file is linked in as bitcode
+*/
+void instrument_function_detect(const void *site_arg)
+{
+	const struct te_site *site = site_arg;
+	long delta = current_time - previous_time;
+	long pre = pre_bb_num;
+	long i = 0, half, len;
+
+	if(site->hash_bits == 0)
+	{
+		for(len = site->n; len > 1; len -= half)
+		{
+			half = len / 2;
+			i = (site->ctx[i + half] <= pre) ? i + half : i;
+		}
+	}
+	else
+	{
+		unsigned long mask = (1UL << site->hash_bits) - 1;
+		for(i = te_site_hash(pre, site->hash_bits); site->ctx[i] != pre; i = (i + 1) & mask)
+			if((unsigned long)site->ctx[i] == TE_TABLE_EMPTY)
+				break;
+	}
+
+	//contexts never seen in training are not checked
+	if(__builtin_expect(site->n > 0 && site->ctx[i] == pre && (delta < site->b[i] || delta > site->c[i]), 0))
+		te_detect_report(site->site_id, pre, delta);
+
+	//the check itself is not part of the next interval
+	previous_time = current_time;
+}
+
+//sampled checking: xorshift state behind the random countdowns, reseeded from rdrand (-mrdrnd) at every ecall entry
+//not static: linkRuntime makes it available_externally, so every module and every inlined copy shares this one
+unsigned long te_sample_state = 0x9E3779B97F4A7C15UL;
+
+long instrument_function_sample_seed(long i)
+{
+	unsigned long long seed;
+	int tries;
+
+	for(tries = 0; tries < 10; tries++)
+		if(_rdrand64_step(&seed))
+		{
+			//xorshift never leaves 0
+			te_sample_state = seed | 1;
+			break;
+		}
+	return 0;
+}
+
+/**
+	next countdown of a sampled site, uniform in [1, 2 * period - 1], so period on average
+*/
+long instrument_function_sample_next(long period)
+{
+	unsigned long x = te_sample_state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	te_sample_state = x;
+	return 1 + x % (2 * period - 1);
+}
+
+/**
+	mode 16: end of an interval, the next one is faulted when the countdown runs out and then starts with the
+	delay ticks of an exit, period: intervals per faulted one, random countdowns of that average when random is 1
+*/
+void instrument_function_fault_next(long period, long random, long delay)
+{
+	if(--te_fault_countdown > 0)
+	{
+		te_fault_armed = 0;
+		return;
+	}
+	te_fault_countdown = random ? instrument_function_sample_next(period) : period;
+	te_fault_armed = 1;
+	instrument_function_inject_delay(delay);
+}
+
+/**
+	average cost of a check in get_time cycles, at the end of ecall
+*/
+long instrument_function_dump_check_cycles(long i)
+{
+	if(te_check_count)
+		printf("checks: %lu, cycles per check: %lu\n", te_check_count, te_check_cycles / te_check_count);
+	te_check_cycles = 0;
+	te_check_count = 0;
+	return 0;
+}
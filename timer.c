@@ -8,6 +8,7 @@
 #include "Enclave_t.h"
 
 extern void printf(const char *fmt, ...);
+extern unsigned long get_time(unsigned long);
 
 //global variables
 volatile unsigned long current_time = 0;
@@ -119,6 +120,26 @@ void secure_timer()
 
 }
 
+/**
+	clock calibration for mode 22: reads get_time (rdtsc) and current_time side by side, the timer thread has to run
+	prints per sample: cycles in the middle of the window, ticks, half width of the window; save them as ./tclockdata.txt
+*/
+void calibrate_clock(long samples)
+{
+	long i;
+	unsigned long before, ticks, after;
+
+	for(i = 0; i < samples; i++)
+	{
+		before = get_time(1);
+		ticks = current_time;
+		after = get_time(1);
+		printf("%lu\n%lu\n%lu\n", before + (after - before) / 2, ticks, (after - before + 1) / 2);
+		//spread the samples over a wider range
+		my_udelay(10 * (i % 16 + 1));
+	}
+}
+
 void set_infinite_loop_flag_false(int i)
 {
 	infinite_loop_flag = 0;